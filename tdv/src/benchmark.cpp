@@ -0,0 +1,559 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <cstdlib>
+#include <new>
+#include <regex>
+#include <limits>
+#include <stdexcept>
+#include "types.h"
+#include "wiktdb.h"
+#include "sparsearray.h"
+#include "stringutils.h"
+#include "vectorize.h"
+
+// Heap allocations made by the process, counted for the kernel benchmarks.
+// All the replaceable forms are replaced, so that every allocation is counted and freed by the matching function.
+// None of them is inlined: inlined into new and delete expressions, malloc() and free() look mismatched to the compiler.
+std::atomic<ulong> allocationCount(0);
+
+static void* countedAlloc(size_t size)
+{
+    allocationCount++;
+    return malloc(size ? size : 1);
+}
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    void *ptr = countedAlloc(size);
+
+    if (!ptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+__attribute__((noinline)) void* operator new[](size_t size)
+{
+    void *ptr = countedAlloc(size);
+
+    if (!ptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+__attribute__((noinline)) void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return countedAlloc(size);
+}
+
+__attribute__((noinline)) void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return countedAlloc(size);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr, const std::nothrow_t&) noexcept
+{
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void *ptr, const std::nothrow_t&) noexcept
+{
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+// Loads the DB and meaning vectors the same way the service does.
+WiktDB *loadData(const string& configFileName)
+{
+    MeaningExtractor::config.load(configFileName);
+
+    WiktDB *wiktdb = new WiktDB();
+    std::cout << "Loading DB..." << std::endl;
+    wiktdb->loadDB(MeaningExtractor::config.wiktDBPath, MeaningExtractor::config.wiktDBCacheSize, &MeaningExtractor::threadPool());
+    std::cout << "DB loaded." << std::endl;
+
+    MeaningExtractor::setDB(wiktdb);
+
+    std::cout << "Loading vectors..." << std::endl;
+    MeaningExtractor::loadVectorsFromFile(MeaningExtractor::config.meaningFilePath);
+
+    return wiktdb;
+}
+
+vector<string> sampleTerms(WiktDB *wiktdb, uint numTerms)
+{
+    vector<string> terms;
+    std::mt19937 rng(42);
+
+    for (ulong i = 0; i < wiktdb->size(); i++)
+        terms.push_back(wiktdb->invIndex.term(i).str());
+
+    std::sort(terms.begin(), terms.end());
+    std::shuffle(terms.begin(), terms.end(), rng);
+
+    if (terms.size() > numTerms)
+        terms.resize(numTerms);
+
+    return terms;
+}
+
+// Runs one request-path operation (as in the service handlers) and reduces its result to a checksum.
+double runRequestOp(uint op, const string& term1, const string& term2)
+{
+    double checksum = 0;
+
+    switch (op % 5)
+    {
+        case 0:
+            checksum = MeaningExtractor::similarity(term1, "", term2, "", vector<string>(), 1);
+            break;
+        case 1:
+        {
+            VectorOptions options;
+            options.graphFill = true;
+            options.linkSearchDepth = 1;
+
+            for (auto pair : MeaningExtractor::getVector(term1, "noun", options))
+                checksum += pair.first * pair.second;
+            break;
+        }
+        case 2:
+            for (auto pair : MeaningExtractor::similarRepr(Meaning(term1).getVector(), 20, false))
+                checksum += pair.first * pair.second;
+            break;
+        case 3:
+            checksum = MeaningExtractor::disambiguate(term1, "", vector<string>({term2})).descr.size();
+            break;
+        case 4:
+            for (auto pair : Meaning(term1, vector<string>({term2})).getVector())
+                checksum += pair.first * pair.second;
+            break;
+    }
+
+    return checksum;
+}
+
+// Runs the request-path operations from several threads and checks the results against a serial run.
+// Build with 'make tsan' to have data races reported by ThreadSanitizer.
+int stress(const string& configFileName, uint numThreads, uint numOps)
+{
+    WiktDB *wiktdb = loadData(configFileName);
+    vector<string> terms = sampleTerms(wiktdb, 200);
+    vector<double> expected(numOps);
+    std::atomic<ulong> mismatches(0);
+
+    if (terms.size() < 2)
+    {
+        std::cerr << "Not enough terms in the DB." << std::endl;
+        return 1;
+    }
+
+    auto opTerm = [&](uint i, uint k) -> const string& { return terms[(i * 7 + k * 13) % terms.size()]; };
+
+    for (uint i = 0; i < numOps; i++)
+        expected[i] = runRequestOp(i, opTerm(i, 0), opTerm(i, 1));
+
+    auto start = std::chrono::steady_clock::now();
+    vector<std::thread> threads;
+
+    for (uint t = 0; t < numThreads; t++)
+    {
+        threads.push_back(std::thread([&, t]
+        {
+            // Every thread runs all operations, starting at a different one.
+            for (uint n = 0; n < numOps; n++)
+            {
+                uint i = (n + t * numOps / numThreads) % numOps;
+
+                if (runRequestOp(i, opTerm(i, 0), opTerm(i, 1)) != expected[i])
+                    mismatches++;
+            }
+        }));
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << numThreads << " threads x " << numOps << " operations in " << elapsed << "s, "
+              << mismatches << " results differ from the serial run." << std::endl;
+
+    return (mismatches > 0) ? 1 : 0;
+}
+
+// Calls op(i) for every item i, rounds times, and reports the time and heap allocations per call,
+// or the calls per second if a unit is given for them.
+template <class Op>
+void benchmarkLoop(const string& name, ulong numItems, uint rounds, const Op& op, const string& callUnit = "")
+{
+    double checksum = 0;
+    ulong allocations = allocationCount;
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint r = 0; r < rounds; r++)
+    {
+        for (ulong i = 0; i < numItems; i++)
+            checksum += op(i);
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ulong calls = numItems * rounds;
+
+    std::cout << std::left << std::setw(32) << name << std::right << std::setw(10) << std::fixed << std::setprecision(1);
+
+    if (callUnit.empty())
+        std::cout << elapsed * 1e9 / calls << " ns/call" << std::setw(10) << std::setprecision(3) << double(allocationCount - allocations) / calls << " allocs/call";
+    else
+        std::cout << calls / elapsed << " " << callUnit << "/s";
+
+    std::cout << "   (checksum " << std::setprecision(3) << checksum << ")" << std::endl;
+}
+
+// Runs a request handler's work for every sampled term and reports requests per second.
+void benchmarkRequests(const string& name, const vector<string>& terms, uint rounds, const std::function<double(uint)>& request)
+{
+    benchmarkLoop(name, terms.size(), rounds, [&](ulong i) { return request(i); }, "requests");
+}
+
+// Single-threaded throughput of the /repr and /disambig handlers, without the HTTP layer.
+int requests(const string& configFileName, uint numTerms, uint rounds)
+{
+    WiktDB *wiktdb = loadData(configFileName);
+    vector<string> terms = sampleTerms(wiktdb, numTerms);
+
+    if (terms.size() < 2)
+    {
+        std::cerr << "Not enough terms in the DB." << std::endl;
+        return 1;
+    }
+
+    // Each disambiguation sentence has the next few sampled terms as context.
+    auto context = [&](uint i)
+    {
+        vector<string> ctx;
+
+        for (uint k = 1; k <= 4; k++)
+            ctx.push_back(terms[(i + k) % terms.size()]);
+
+        return ctx;
+    };
+
+    benchmarkRequests("/repr", terms, rounds, [&](uint i)
+    {
+        return MeaningExtractor::jsonRepr(Meaning(terms[i]).getVector(), false).size();
+    });
+
+    benchmarkRequests("/disambig", terms, rounds, [&](uint i)
+    {
+        SparseArray vec = Meaning(terms[i]).getVector();
+        const Meaning& disambigMeaning = MeaningExtractor::disambiguate(terms[i], "", context(i));
+
+        return vec.size() + disambigMeaning.descr.size();
+    });
+
+    return 0;
+}
+
+// Times a kernel over the sampled vector pairs and reports time and heap allocations per call.
+void benchmarkKernel(const string& name, const vector<std::pair<const Meaning*, const Meaning*>>& pairs, uint rounds,
+                     const std::function<double(const Meaning&, const Meaning&)>& kernel)
+{
+    benchmarkLoop(name, pairs.size(), rounds, [&](ulong i) { return kernel(*pairs[i].first, *pairs[i].second); });
+}
+
+// Micro-benchmark of the sparse vector kernels over random pairs of cached meaning vectors.
+int kernels(const string& configFileName, uint numPairs)
+{
+    loadData(configFileName);
+
+    SparseArray::IntersectKernel detectedKernel = SparseArray::intersectKernel();
+    vector<const Meaning*> meanings;
+    vector<std::pair<const Meaning*, const Meaning*>> pairs;
+    std::mt19937 rng(42);
+
+    for (auto it = MeaningExtractor::reprCache.begin(); it != MeaningExtractor::reprCache.end(); ++it)
+        meanings.push_back(&it->second);
+
+    if (meanings.empty())
+    {
+        std::cerr << "No meaning vectors loaded." << std::endl;
+        return 1;
+    }
+
+    for (uint i = 0; i < numPairs; i++)
+        pairs.push_back(std::make_pair(meanings[rng() % meanings.size()], meanings[rng() % meanings.size()]));
+
+    uint rounds = std::max(1u, 2000000 / numPairs);
+
+    for (auto intersectKernel : {SparseArray::IntersectKernel::scalar, SparseArray::IntersectKernel::sse,
+                                 SparseArray::IntersectKernel::avx2})
+    {
+        if (!SparseArray::setIntersectKernel(intersectKernel))
+            continue;
+
+        string suffix = string(" [") + SparseArray::intersectKernelName(intersectKernel) + "]";
+
+        benchmarkKernel("dot product" + suffix, pairs, rounds, [](const Meaning& a, const Meaning& b) { return a.repr * b.repr; });
+        benchmarkKernel("keyIntersectionSize" + suffix, pairs, rounds, [](const Meaning& a, const Meaning& b)
+                        { return SparseArray::keyIntersectionSize(a.repr, b.repr); });
+    }
+
+    SparseArray::setIntersectKernel(detectedKernel);
+    std::cout << "Intersection kernel: " << SparseArray::intersectKernelName(detectedKernel) << std::endl;
+
+    benchmarkKernel("dot product", pairs, rounds, [](const Meaning& a, const Meaning& b) { return a.repr * b.repr; });
+    benchmarkKernel("cosine", pairs, rounds, [](const Meaning& a, const Meaning& b) { return SparseArray::cosine(a.repr, b.repr); });
+    benchmarkKernel("cosine (cached norms)", pairs, rounds, [](const Meaning& a, const Meaning& b)
+                    { return SparseArray::cosine(a.repr, b.repr, a.norm, b.norm); });
+    benchmarkKernel("weightedCosine", pairs, rounds, [](const Meaning& a, const Meaning& b)
+                    { return SparseArray::weightedCosine(a.repr, b.repr, 1.0, 0.5); });
+    benchmarkKernel("keyIntersectionSize", pairs, rounds, [](const Meaning& a, const Meaning& b)
+                    { return SparseArray::keyIntersectionSize(a.repr, b.repr); });
+
+    // Reference: the earlier implementation copied both vectors before looking up the keys of the smaller one.
+    benchmarkKernel("keyIntersectionSize (copies)", pairs, rounds, [](const Meaning& a, const Meaning& b)
+    {
+        SparseArray big = (a.repr.size() > b.repr.size()) ? a.repr : b.repr;
+        SparseArray small = (a.repr.size() > b.repr.size()) ? b.repr : a.repr;
+        size_t size = 0;
+
+        for (auto it = small.begin(); it != small.end(); ++it)
+            size += big.count(it->first);
+
+        return size;
+    });
+
+    return 0;
+}
+
+// Recall@k of the approximate (LSH) similar search against the exact one, over random cached meaning vectors.
+// Only the exact neighbours with a non-zero cosine are counted.
+int recall(const string& configFileName, uint numQueries, uint k)
+{
+    loadData(configFileName);
+
+    if (!MeaningExtractor::lshIndex.isBuilt())
+    {
+        std::cerr << "No LSH index: set lsh_tables in the configuration." << std::endl;
+        return 1;
+    }
+
+    vector<const Meaning*> meanings;
+    std::mt19937 rng(42);
+
+    for (auto it = MeaningExtractor::reprCache.begin(); it != MeaningExtractor::reprCache.end(); ++it)
+        meanings.push_back(&it->second);
+
+    for (bool reversed : {false, true})
+    {
+        ulong found = 0, expected = 0;
+        double exactTime = 0, approxTime = 0;
+
+        for (uint q = 0; q < numQueries; q++)
+        {
+            const SparseArray& vec = meanings[rng() % meanings.size()]->repr;
+
+            auto start = std::chrono::steady_clock::now();
+            vector<std::pair<ulong, float>> exact = MeaningExtractor::similarRepr(vec, k, reversed, "", "", false);
+            auto middle = std::chrono::steady_clock::now();
+            vector<std::pair<ulong, float>> approx = MeaningExtractor::similarRepr(vec, k, reversed, "", "", true);
+            auto end = std::chrono::steady_clock::now();
+
+            exactTime += std::chrono::duration<double>(middle - start).count();
+            approxTime += std::chrono::duration<double>(end - middle).count();
+
+            set<ulong> approxIds;
+            for (const auto& pair : approx)
+                approxIds.insert(pair.first);
+
+            // Meanings with cosine 0 (no shared dimension) only fill the list up, in meaning ID order.
+            for (const auto& pair : exact)
+            {
+                if (pair.second != 0)
+                {
+                    found += approxIds.count(pair.first);
+                    expected++;
+                }
+            }
+        }
+
+        std::cout << (reversed ? "dissimilar" : "similar   ") << "  recall@" << k << ": " << std::fixed << std::setprecision(3)
+                  << double(found) / std::max(1ul, expected) << "   exact: " << exactTime * 1e3 / numQueries
+                  << " ms/query   approx: " << approxTime * 1e3 / numQueries << " ms/query" << std::endl;
+    }
+
+    return 0;
+}
+
+// Times a string operation over the descriptions and reports time and heap allocations per call.
+void benchmarkStrings(const string& name, const vector<string>& descrs, uint rounds, const std::function<size_t(const string&)>& operation)
+{
+    benchmarkLoop(name, descrs.size(), rounds, [&](ulong i) { return operation(descrs[i]); });
+}
+
+// Micro-benchmark of description tokenization and markup removal, against the former regex based versions.
+int tokenize(const string& configFileName, uint numTerms)
+{
+    MeaningExtractor::config.load(configFileName);
+
+    WiktDB wiktdb;
+    wiktdb.loadDB(MeaningExtractor::config.wiktDBPath, MeaningExtractor::config.wiktDBCacheSize, &MeaningExtractor::threadPool());
+
+    vector<string> descrs;
+
+    for (const string& term : sampleTerms(&wiktdb, numTerms))
+    {
+        EntryRef termRef = wiktdb.entry(term);
+
+        for (const json& langRef : (*termRef)[FLD_LANGS])
+        {
+            for (const json& meaningRefs : langRef[FLD_MEANINGS])
+            {
+                for (const json& meaningRef : meaningRefs)
+                    descrs.push_back(meaningRef[FLD_MEANING_DESCR]);
+            }
+        }
+    }
+
+    std::cout << descrs.size() << " descriptions." << std::endl;
+
+    ulong differences = 0;
+    uint rounds = std::max(1ul, 200000 / std::max(1ul, (ulong)descrs.size()));
+
+    auto regexSplit = [](const string& str)
+    {
+        std::regex rgx(" ");
+        std::sregex_token_iterator first{str.begin(), str.end(), rgx, -1}, last;
+        return vector<string>(first, last);
+    };
+
+    std::regex markupRgx("\\{\\{[^\\}]+\\}\\}");
+
+    for (const string& descr : descrs)
+    {
+        if (regexSplit(descr) != StringUtils::split(descr) || std::regex_replace(descr, markupRgx, "") != StringUtils::stripTemplates(descr))
+            differences++;
+    }
+
+    benchmarkStrings("split (regex)", descrs, rounds, [&](const string& descr) { return regexSplit(descr).size(); });
+    benchmarkStrings("split", descrs, rounds, [](const string& descr) { return StringUtils::split(descr).size(); });
+    benchmarkStrings("tokenizer", descrs, rounds, [](const string& descr)
+    {
+        StringRef token;
+        size_t numTokens = 0;
+
+        for (Tokenizer tokenizer(descr, " "); tokenizer.next(token);)
+            numTokens++;
+
+        return numTokens;
+    });
+    benchmarkStrings("split whitespace", descrs, rounds, [](const string& descr) { return StringUtils::splitWhitespace(descr).size(); });
+    benchmarkStrings("strip templates (regex)", descrs, rounds, [&](const string& descr) { return std::regex_replace(descr, markupRgx, "").size(); });
+    benchmarkStrings("strip templates", descrs, rounds, [](const string& descr) { return StringUtils::stripTemplates(descr).size(); });
+
+    std::cout << differences << " descriptions give different results." << std::endl;
+
+    return (differences > 0) ? 1 : 0;
+}
+
+// Parses a count argument: a positive integer.
+static bool parseCount(const string& arg, uint& count)
+{
+    size_t end = 0;
+
+    try
+    {
+        ulong value = std::stoul(arg, &end);
+
+        if (arg[0] == '-' || value == 0 || value > std::numeric_limits<uint>::max())
+            return false;
+
+        count = value;
+    }
+    catch (const std::logic_error&)
+    {
+        return false;
+    }
+
+    return end == arg.size();
+}
+
+static int usage(const char *name)
+{
+    std::cout << "Usage: " << name << " stress <config. filename> <threads> <operations>" << std::endl;
+    std::cout << "       " << name << " kernels <config. filename> <vector pairs>" << std::endl;
+    std::cout << "       " << name << " recall <config. filename> <queries> <k>" << std::endl;
+    std::cout << "       " << name << " tokenize <config. filename> <terms>" << std::endl;
+    std::cout << "       " << name << " requests <config. filename> <terms> <rounds>" << std::endl;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    string mode = (argc > 1) ? argv[1] : "";
+    uint numPairs = 0;
+    uint numThreads = 0, numOps = 0;
+    uint numQueries = 0, k = 0;
+
+    if (!(argc == 5 && mode == "stress") && !(argc == 4 && mode == "kernels") && !(argc == 5 && mode == "recall") &&
+        !(argc == 4 && mode == "tokenize") && !(argc == 5 && mode == "requests"))
+    {
+        return usage(argv[0]);
+    }
+
+    // Checked before loading the data.
+    if ((mode == "kernels" && !parseCount(argv[3], numPairs)) ||
+        (mode == "stress" && (!parseCount(argv[3], numThreads) || !parseCount(argv[4], numOps))) ||
+        (mode == "recall" && (!parseCount(argv[3], numQueries) || !parseCount(argv[4], k))))
+    {
+        return usage(argv[0]);
+    }
+
+    try
+    {
+        if (mode == "kernels")
+            return kernels(argv[2], numPairs);
+
+        if (mode == "recall")
+            return recall(argv[2], numQueries, k);
+
+        if (mode == "tokenize")
+            return tokenize(argv[2], std::stoul(argv[3]));
+
+        if (mode == "requests")
+            return requests(argv[2], std::stoul(argv[3]), std::stoul(argv[4]));
+
+        return stress(argv[2], numThreads, numOps);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -1,6 +1,7 @@
 #include "config.h"
 #include <fstream>
 #include <unordered_map>
+#include <stdexcept>
 #include <json/json.hpp>
 
 using nlohmann::json;
@@ -21,8 +22,18 @@ void Config::load(const string &filename)
     }
 
     wiktDBPath = jsonConf[WIKT_DB];
+    wiktDBCacheSize = jsonConf.value(WIKT_DB_CACHE_SIZE, 0ul);
     meaningFilePath = jsonConf[MEANING_FILE];
     humanReadable = jsonConf[HUMAN_READABLE];
+    similarSearch = jsonConf.value(SIMILAR_SEARCH, SIMILAR_SEARCH_INDEX);
+
+    if (similarSearch != SIMILAR_SEARCH_INDEX && similarSearch != SIMILAR_SEARCH_EXACT && similarSearch != SIMILAR_SEARCH_VERIFY)
+        throw std::runtime_error("Invalid " SIMILAR_SEARCH " in " + filename + ": " + similarSearch);
+
+    numThreads = jsonConf.value(NUM_THREADS, 0);
+    similarThreads = jsonConf.value(SIMILAR_THREADS, 1);
+    lshTables = jsonConf.value(LSH_TABLES, 0);
+    lshBits = jsonConf.value(LSH_BITS, 0);
 
     linkWeights.link_weak = jsonConf[LINK_WEIGHTS][LINK_WEAK];
     linkWeights.link_context = jsonConf[LINK_WEIGHTS][LINK_CONTEXT];
@@ -23,8 +23,19 @@
 #define LINK_SEARCH_DEPTH "link_search_depth"
 
 #define WIKT_DB "wikt_db_path"
+#define WIKT_DB_CACHE_SIZE "wikt_db_cache_size"
 #define MEANING_FILE "meaning_file_path"
 #define HUMAN_READABLE "human_readable"
+#define SIMILAR_SEARCH "similar_search"
+#define NUM_THREADS "num_threads"
+#define SIMILAR_THREADS "similar_threads"
+#define LSH_TABLES "lsh_tables"
+#define LSH_BITS "lsh_bits"
+
+// Similar search modes: inverted index, exhaustive scan, or both with a comparison (verification).
+#define SIMILAR_SEARCH_INDEX "index"
+#define SIMILAR_SEARCH_EXACT "exact"
+#define SIMILAR_SEARCH_VERIFY "verify"
 
 struct LinkWeights
 {
@@ -47,8 +58,17 @@ class Config
     uint linkSearchDepth;
     LinkWeights linkWeights;
     string wiktDBPath;
+    // Decoded WiktDB entries kept in memory (0 = all).
+    ulong wiktDBCacheSize;
     string meaningFilePath;
     bool humanReadable;
+    string similarSearch;
+    uint numThreads;
+    // Shards (run on the thread pool) per similar search; 0 uses all pool threads.
+    uint similarThreads;
+    // LSH index for approximate similar searches: number of hash tables (0 = no index) and bits per table (0 = auto).
+    uint lshTables;
+    uint lshBits;
 
     void load(const string& configFilePath);
 };
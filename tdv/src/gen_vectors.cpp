@@ -1,6 +1,12 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <algorithm>
 #include "types.h"
 #include "wiktdb.h"
 #include "sparsearray.h"
@@ -12,7 +18,7 @@ void loadData(const string& configFileName)
     
     WiktDB *wiktdb = new WiktDB();
     std::cout << "Loading DB..." << std::endl;
-    wiktdb->loadDB(MeaningExtractor::config.wiktDBPath);
+    wiktdb->loadDB(MeaningExtractor::config.wiktDBPath, MeaningExtractor::config.wiktDBCacheSize, &MeaningExtractor::threadPool());
     std::cout << "DB loaded." << std::endl;
     
     MeaningExtractor::setDB(wiktdb);
@@ -21,8 +27,15 @@ void loadData(const string& configFileName)
     MeaningExtractor::preloadVectors();
 }
 
-void writeConcepts(const string& oFileName)
+// Binary snapshots are loaded by MeaningExtractor::loadVectorsFromFile much faster than the JSON list.
+void writeConcepts(const string& oFileName, bool binary)
 {
+    if (binary)
+    {
+        MeaningExtractor::writeSnapshot(oFileName);
+        return;
+    }
+
     std::ofstream fMeanings;
     json meaningList = json::array();
     bool humanReadable = MeaningExtractor::config.humanReadable;
@@ -80,51 +93,127 @@ void writeVectors(const string& oFileName)
     fVectors.close();
 }
 
+// Cosine matrix file (<output>.cosines.bin), native byte order:
+//   header: char magic[8] = "TDVCOSUT" | uint32 version | uint32 tileSize | uint64 numConcepts | uint64 numTiles
+//   tiles:  uint64 tileRow | uint64 tileCol | rows * cols float32, row-major
+// Rows and columns follow the order of <output>.concepts.json. Only tiles with tileCol >= tileRow are stored
+// (upper triangle): cosine(i, j) for i > j is read from (j, i). Tile (r, c) covers concepts
+// [r * tileSize, min((r + 1) * tileSize, numConcepts)) x [c * tileSize, ...), and tiles are stored in row-major
+// order of the tile grid. Diagonal tiles are stored in full, with 1 on the diagonal.
+#define COSINES_MAGIC "TDVCOSUT"
+#define COSINES_VERSION 1
+
+// Concepts per tile side: a tile's vectors and its 256 KB of output fit in the L2 cache.
+const uint COSINES_TILE_SIZE = 256;
+
+struct CosinesHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t tileSize;
+    uint64_t numConcepts;
+    uint64_t numTiles;
+};
+
 void writeCosines(const string& oFileName)
 {
     std::ofstream fCosines;
     std::ofstream fConcepts;
     json concepts = json::array();
+    vector<const SparseArray*> vecs;
+    vector<float> norms;
 
     fCosines.open(oFileName + ".cosines.bin", std::ios::binary);
     fConcepts.open(oFileName + ".concepts.json");
 
-    ulong numConcepts = MeaningExtractor::reprCache.size();
-    ulong countDone = 0;
-
-	fCosines.write(reinterpret_cast<const char *>(&numConcepts), sizeof(ulong));
-
-    for (auto it1 = MeaningExtractor::reprCache.begin(); it1 != MeaningExtractor::reprCache.end(); ++it1)
+    for (auto it = MeaningExtractor::reprCache.begin(); it != MeaningExtractor::reprCache.end(); ++it)
     {
         json meaning = json::object();
-        meaning[FLD_ID] = it1->first;
-        meaning[FLD_TERM] = it1->second.term;
-        meaning[FLD_POS] = it1->second.pos;
+        meaning[FLD_ID] = it->first;
+        meaning[FLD_TERM] = it->second.term;
+        meaning[FLD_POS] = it->second.pos;
         concepts.push_back(meaning);
 
-        for (auto it2 = MeaningExtractor::reprCache.begin(); it2 != MeaningExtractor::reprCache.end(); ++it2)
+        vecs.push_back(&it->second.repr);
+        norms.push_back(it->second.norm);
+    }
+
+    fConcepts << concepts << std::endl;
+
+    ulong numConcepts = vecs.size();
+    ulong numTileRows = (numConcepts + COSINES_TILE_SIZE - 1) / COSINES_TILE_SIZE;
+    vector<std::pair<ulong, ulong>> tiles;
+
+    for (ulong r = 0; r < numTileRows; r++)
+    {
+        for (ulong c = r; c < numTileRows; c++)
+            tiles.push_back(std::make_pair(r, c));
+    }
+
+    CosinesHeader header;
+    memcpy(header.magic, COSINES_MAGIC, sizeof(header.magic));
+    header.version = COSINES_VERSION;
+    header.tileSize = COSINES_TILE_SIZE;
+    header.numConcepts = numConcepts;
+    header.numTiles = tiles.size();
+    fCosines.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    // Tiles are computed in batches across the pool and written in order, which bounds the buffered output.
+    ThreadPool& pool = MeaningExtractor::threadPool();
+    ulong batchSize = pool.size() * 4;
+    vector<vector<float>> tileBuffers(batchSize);
+
+    for (ulong batchStart = 0; batchStart < tiles.size(); batchStart += batchSize)
+    {
+        ulong batchEnd = std::min(batchStart + batchSize, (ulong)tiles.size());
+
+        pool.parallelFor(batchEnd - batchStart, [&](ulong task, uint worker)
         {
-            float sim = 0;
-            if (it1->first != it2->first)
-                sim = MeaningExtractor::similarity(it1->second.term, it1->second.pos, it2->second.term, it2->second.pos, vector<string>(), 1);
-            else
-                sim = 1;
+            ulong rowStart = tiles[batchStart + task].first * COSINES_TILE_SIZE;
+            ulong colStart = tiles[batchStart + task].second * COSINES_TILE_SIZE;
+            ulong rows = std::min((ulong)COSINES_TILE_SIZE, numConcepts - rowStart);
+            ulong cols = std::min((ulong)COSINES_TILE_SIZE, numConcepts - colStart);
+            vector<float>& tile = tileBuffers[task];
 
-            //if (it2 != MeaningExtractor::reprCache.begin())
-            //    fCosines << "\t";
+            tile.assign(rows * cols, 0.0);
 
-            fCosines.write(reinterpret_cast<const char *>(&sim), sizeof(float));
-        }
+            for (ulong i = 0; i < rows; i++)
+            {
+                // On diagonal tiles only j > i is computed, the rest is mirrored.
+                ulong jStart = (rowStart == colStart) ? i + 1 : 0;
+
+                for (ulong j = jStart; j < cols; j++)
+                {
+                    float cos = (*vecs[rowStart + i] * *vecs[colStart + j]) / (norms[rowStart + i] * norms[colStart + j]);
+                    tile[i * cols + j] = std::isnan(cos) ? 0.0 : cos;
+                }
+            }
 
-        //fCosines << std::endl;
+            if (rowStart == colStart)
+            {
+                for (ulong i = 0; i < rows; i++)
+                {
+                    tile[i * cols + i] = 1;
 
-        countDone++;
+                    for (ulong j = i + 1; j < cols; j++)
+                        tile[j * cols + i] = tile[i * cols + j];
+                }
+            }
+        });
 
-        //if (countDone % 10 == 0)
-        std::cout << std::setw(4) << (float(countDone) * 100) / numConcepts << "% completed\r";
+        for (ulong t = batchStart; t < batchEnd; t++)
+        {
+            uint64_t tilePos[2] = {tiles[t].first, tiles[t].second};
+            const vector<float>& tile = tileBuffers[t - batchStart];
+
+            fCosines.write(reinterpret_cast<const char *>(tilePos), sizeof(tilePos));
+            fCosines.write(reinterpret_cast<const char *>(tile.data()), tile.size() * sizeof(float));
+        }
+
+        std::cout << std::setw(4) << (float(batchEnd) * 100) / tiles.size() << "% completed\r" << std::flush;
     }
 
-    fConcepts << concepts << std::endl;
+    std::cout << std::endl;
 
     fConcepts.flush();
     fCosines.flush();
@@ -132,17 +221,187 @@ void writeCosines(const string& oFileName)
     fCosines.close();
 }
 
+// k-NN graph shards (<output>.knn.<shard>, shard numbered from 0, 5 digits), native byte order, CSR layout:
+//   header:  char magic[8] = "TDVKNNSH" | uint32 version | uint32 k | float32 threshold | uint32 reserved
+//            | uint64 numConcepts | uint64 shard | uint64 numShards | uint64 firstRow | uint64 numRows | uint64 numEdges
+//   rowIds:      numRows uint64 meaning IDs
+//   offsets:     numRows + 1 uint64, neighbours of row i are entries [offsets[i], offsets[i + 1])
+//   neighbours:  numEdges uint64 meaning IDs
+//   scores:      numEdges float32 cosines
+// Rows are meanings sorted by ID, neighbours are sorted by decreasing cosine (ties by ID), the meaning itself
+// excluded, and only cosines >= threshold are kept. Shards are written to a temporary file and renamed when
+// complete, so an interrupted run can be restarted with the same arguments and skips the finished shards.
+#define KNN_MAGIC "TDVKNNSH"
+#define KNN_VERSION 1
+
+const ulong KNN_SHARD_SIZE = 65536;
+
+struct KnnShardHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t k;
+    float threshold;
+    uint32_t reserved;
+    uint64_t numConcepts;
+    uint64_t shard;
+    uint64_t numShards;
+    uint64_t firstRow;
+    uint64_t numRows;
+    uint64_t numEdges;
+};
+
+bool knnShardDone(const string& shardFileName, const KnnShardHeader& expected)
+{
+    std::ifstream fShard(shardFileName, std::ios::binary | std::ios::ate);
+    KnnShardHeader header;
+
+    if (!fShard.is_open())
+        return false;
+
+    ulong fileSize = fShard.tellg();
+    fShard.seekg(0);
+
+    if (!fShard.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+
+    ulong expectedSize = sizeof(header) + (header.numRows * 2 + 1 + header.numEdges) * sizeof(uint64_t) + header.numEdges * sizeof(float);
+
+    return memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 && header.version == expected.version &&
+           header.k == expected.k && header.threshold == expected.threshold && header.numConcepts == expected.numConcepts &&
+           header.shard == expected.shard && header.numShards == expected.numShards &&
+           header.firstRow == expected.firstRow && header.numRows == expected.numRows && fileSize == expectedSize;
+}
+
+void writeKnn(const string& oFileName, uint k, float threshold)
+{
+    vector<ulong> rowIds;
+
+    for (auto it = MeaningExtractor::reprCache.begin(); it != MeaningExtractor::reprCache.end(); ++it)
+        rowIds.push_back(it->first);
+
+    std::sort(rowIds.begin(), rowIds.end());
+
+    ulong numConcepts = rowIds.size();
+    ulong numShards = (numConcepts + KNN_SHARD_SIZE - 1) / KNN_SHARD_SIZE;
+    ThreadPool& pool = MeaningExtractor::threadPool();
+
+    for (ulong shard = 0; shard < numShards; shard++)
+    {
+        std::ostringstream shardSuffix;
+        shardSuffix << ".knn." << std::setw(5) << std::setfill('0') << shard;
+        string shardFileName = oFileName + shardSuffix.str();
+
+        KnnShardHeader header;
+        memcpy(header.magic, KNN_MAGIC, sizeof(header.magic));
+        header.version = KNN_VERSION;
+        header.k = k;
+        header.threshold = threshold;
+        header.reserved = 0;
+        header.numConcepts = numConcepts;
+        header.shard = shard;
+        header.numShards = numShards;
+        header.firstRow = shard * KNN_SHARD_SIZE;
+        header.numRows = std::min(KNN_SHARD_SIZE, numConcepts - header.firstRow);
+        header.numEdges = 0;
+
+        if (knnShardDone(shardFileName, header))
+        {
+            std::cout << "Shard " << shard << " already written, skipping." << std::endl;
+            continue;
+        }
+
+        vector<vector<std::pair<ulong, float>>> neighbours(header.numRows);
+
+        pool.parallelFor(header.numRows, [&](ulong row, uint worker)
+        {
+            ulong id = rowIds[header.firstRow + row];
+            const SparseArray& vec = MeaningExtractor::reprCache.at(id).repr;
+
+            for (const std::pair<ulong, float>& neighbour : MeaningExtractor::similarRepr(vec, k + 1, false))
+            {
+                if (neighbour.first != id && neighbour.second >= threshold && neighbours[row].size() < k)
+                    neighbours[row].push_back(neighbour);
+            }
+        });
+
+        vector<uint64_t> shardRowIds(rowIds.begin() + header.firstRow, rowIds.begin() + header.firstRow + header.numRows);
+        vector<uint64_t> offsets(1, 0);
+        vector<uint64_t> neighbourIds;
+        vector<float> scores;
+
+        for (const auto& rowNeighbours : neighbours)
+        {
+            for (const std::pair<ulong, float>& neighbour : rowNeighbours)
+            {
+                neighbourIds.push_back(neighbour.first);
+                scores.push_back(neighbour.second);
+            }
+
+            offsets.push_back(neighbourIds.size());
+        }
+
+        header.numEdges = neighbourIds.size();
+
+        std::ofstream fShard(shardFileName + ".tmp", std::ios::binary);
+        fShard.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        fShard.write(reinterpret_cast<const char *>(shardRowIds.data()), shardRowIds.size() * sizeof(uint64_t));
+        fShard.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+        fShard.write(reinterpret_cast<const char *>(neighbourIds.data()), neighbourIds.size() * sizeof(uint64_t));
+        fShard.write(reinterpret_cast<const char *>(scores.data()), scores.size() * sizeof(float));
+        fShard.close();
+
+        if (!fShard || std::rename((shardFileName + ".tmp").c_str(), shardFileName.c_str()) != 0)
+        {
+            std::cerr << "Error writing k-NN shard: " << shardFileName << std::endl;
+            return;
+        }
+
+        std::cout << std::setw(4) << (float(shard + 1) * 100) / numShards << "% completed\r" << std::flush;
+    }
+
+    std::cout << std::endl;
+}
+
+// Parses the k-NN arguments: K > 0 and a similarity threshold. Returns false if they are not valid.
+static bool parseKnnArgs(const string& kArg, const string& thresholdArg, uint& k, float& threshold)
+{
+    size_t kEnd = 0;
+    size_t thresholdEnd = 0;
+
+    try
+    {
+        ulong kValue = std::stoul(kArg, &kEnd);
+        threshold = std::stof(thresholdArg, &thresholdEnd);
+
+        if (kArg[0] == '-' || kValue == 0 || kValue > std::numeric_limits<uint>::max())
+            return false;
+
+        k = kValue;
+    }
+    catch (const std::logic_error&)
+    {
+        return false;
+    }
+
+    return kEnd == kArg.size() && thresholdEnd == thresholdArg.size() && !std::isnan(threshold);
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 4)
+    string mode = (argc > 3) ? string(argv[3]) : "";
+    uint k = 0;
+    float threshold = 0;
+
+    if ((mode == "knn") ? (argc != 6 || !parseKnnArgs(argv[4], argv[5], k, threshold)) : (argc != 4))
     {
-        std::cout << "Usage: " << argv[0] << " <config. filename> <output filename> <mode: (vectors|concepts|cosines)>" << std::endl;
+        std::cout << "Usage: " << argv[0] << " <config. filename> <output filename> <mode: (vectors|concepts|snapshot|cosines)>" << std::endl;
+        std::cout << "       " << argv[0] << " <config. filename> <output filename> knn <K> <min. similarity>" << std::endl;
     }
     else
     {
         string configFileName(argv[1]);
         string oFileName(argv[2]);
-        string mode(argv[3]);
 
         loadData(configFileName);
 
@@ -150,8 +409,12 @@ int main(int argc, char **argv)
             writeVectors(oFileName);
         else if (mode == "cosines")
             writeCosines(oFileName);
+        else if (mode == "knn")
+            writeKnn(oFileName, k, threshold);
+        else if (mode == "snapshot")
+            writeConcepts(oFileName, true);
         else
-            writeConcepts(oFileName);
+            writeConcepts(oFileName, false);
     }
 
     return 0;
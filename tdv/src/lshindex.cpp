@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cmath>
+#include "lshindex.h"
+#include "similarityindex.h"
+#include "threadpool.h"
+#include "vectorize.h"
+
+// Target number of slots per bucket when the number of bits is picked automatically. Meaning vectors share few
+// dimensions with their neighbours, so neighbour cosines are low and small buckets miss most of them.
+const ulong LSH_BUCKET_SIZE = 128;
+// Bits flipped (one at a time) when probing neighbour buckets.
+const uint LSH_PROBE_BITS = 4;
+const uint LSH_MAX_BITS = 32;
+const ulong LSH_SEED = 0x9e3779b97f4a7c15ul;
+// Slots per build task.
+const ulong LSH_CHUNK_SIZE = 4096;
+
+// SplitMix64 finalizer.
+static inline ulong mixHash(ulong x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ul;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebul;
+    return x ^ (x >> 31);
+}
+
+void LshIndex::project(const SparseArray& vec, uint table, float *projections) const
+{
+    for (uint bit = 0; bit < numBits; bit++)
+        projections[bit] = 0;
+
+    for (size_t i = 0; i < vec.size(); i++)
+    {
+        ulong signs = mixHash((ulong(vec.keyData()[i]) * numTables + table) ^ LSH_SEED);
+        float value = vec.valueData()[i];
+
+        for (uint bit = 0; bit < numBits; bit++)
+            projections[bit] += ((signs >> bit) & 1) ? value : -value;
+    }
+}
+
+void LshIndex::build(const SimilarityIndex& index, uint numTables, uint numBits, ThreadPool& pool)
+{
+    uint numSlots = index.size();
+
+    if (numBits == 0)
+        numBits = std::max(1.0, std::floor(std::log2(std::max(1.0, double(numSlots) / LSH_BUCKET_SIZE))));
+
+    this->index = nullptr;
+    this->numTables = numTables;
+    this->numBits = std::min(numBits, LSH_MAX_BITS);
+
+    vector<vector<std::pair<uint, uint>>> tables(numTables, vector<std::pair<uint, uint>>(numSlots));
+    ulong numTasks = (numSlots + LSH_CHUNK_SIZE - 1) / LSH_CHUNK_SIZE;
+
+    pool.parallelFor(numTasks, [&](ulong task, uint worker)
+    {
+        vector<float> projections(this->numBits);
+
+        for (uint slot = task * LSH_CHUNK_SIZE; slot < std::min<ulong>(numSlots, (task + 1) * LSH_CHUNK_SIZE); slot++)
+        {
+            for (uint table = 0; table < numTables; table++)
+            {
+                uint code = 0;
+
+                project(index.slotMeaning(slot).repr, table, projections.data());
+
+                for (uint bit = 0; bit < this->numBits; bit++)
+                {
+                    if (projections[bit] > 0)
+                        code |= 1u << bit;
+                }
+
+                tables[table][slot] = std::make_pair(code, slot);
+            }
+        }
+    });
+
+    tableSlots.assign(numTables, vector<uint>());
+    tableCodes.assign(numTables, vector<uint>());
+
+    for (uint table = 0; table < numTables; table++)
+    {
+        std::sort(tables[table].begin(), tables[table].end());
+
+        for (const std::pair<uint, uint>& entry : tables[table])
+        {
+            tableCodes[table].push_back(entry.first);
+            tableSlots[table].push_back(entry.second);
+        }
+
+        vector<std::pair<uint, uint>>().swap(tables[table]);
+    }
+
+    this->index = &index;
+}
+
+vector<std::pair<ulong, float>> LshIndex::similar(const SparseArray& vec, uint size, bool reversed, const vector<std::pair<uint, uint>>& ranges) const
+{
+    static thread_local vector<char> seen;
+    vector<uint> candidates;
+    vector<float> projections(numBits);
+    vector<uint> probeBits(numBits);
+    TopK topK(size, reversed);
+    float qNorm = vec.norm();
+
+    if (seen.size() < index->size())
+        seen.resize(index->size(), 0);
+
+    auto inRanges = [&ranges](uint slot)
+    {
+        auto rangeIt = std::upper_bound(ranges.begin(), ranges.end(), slot,
+                                        [](uint slot, const std::pair<uint, uint>& range) { return slot < range.first; });
+        return rangeIt != ranges.begin() && slot < (rangeIt - 1)->second;
+    };
+
+    for (uint table = 0; table < numTables; table++)
+    {
+        uint code = 0;
+
+        project(vec, table, projections.data());
+
+        for (uint bit = 0; bit < numBits; bit++)
+        {
+            // The most dissimilar vectors are the most similar to the negated query.
+            if (reversed)
+                projections[bit] = -projections[bit];
+
+            if (projections[bit] > 0)
+                code |= 1u << bit;
+
+            probeBits[bit] = bit;
+        }
+
+        // The bits closest to flipping give the most likely neighbour buckets.
+        uint numProbes = std::min(LSH_PROBE_BITS, numBits);
+        std::partial_sort(probeBits.begin(), probeBits.begin() + numProbes, probeBits.end(),
+                          [&](uint a, uint b) { return std::fabs(projections[a]) < std::fabs(projections[b]); });
+
+        for (uint probe = 0; probe <= numProbes; probe++)
+        {
+            uint probeCode = (probe == 0) ? code : code ^ (1u << probeBits[probe - 1]);
+            auto bucket = std::equal_range(tableCodes[table].begin(), tableCodes[table].end(), probeCode);
+
+            for (auto it = bucket.first; it != bucket.second; ++it)
+            {
+                uint slot = tableSlots[table][it - tableCodes[table].begin()];
+
+                if (!seen[slot])
+                {
+                    seen[slot] = 1;
+                    candidates.push_back(slot);
+                }
+            }
+        }
+    }
+
+    for (uint slot : candidates)
+    {
+        const Meaning& meaning = index->slotMeaning(slot);
+
+        if (inRanges(slot))
+            topK.push(index->slotId(slot), SparseArray::cosine(vec, meaning.repr, qNorm, meaning.norm));
+
+        seen[slot] = 0;
+    }
+
+    return topK.results();
+}
@@ -0,0 +1,37 @@
+#ifndef LSHINDEX_H
+#define LSHINDEX_H
+#include <utility>
+#include "types.h"
+#include "sparsearray.h"
+
+class SimilarityIndex;
+class ThreadPool;
+
+// Signed random projection (SimHash) index over the similarity index slots, for approximate top-k cosine queries.
+// Each table hashes a vector to the signs of its projections on numBits random hyperplanes. Hyperplane components
+// are +1/-1, drawn from a hash of (dimension, table), so hyperplanes are never stored and negative weights keep
+// their sign. Queries collect the slots in the query's bucket and in the buckets one bit away (for the bits with
+// the smallest projections), and rescore them with the exact cosine. Reversed queries probe the negated vector.
+class LshIndex
+{
+    const SimilarityIndex *index = nullptr;
+    uint numTables = 0;
+    uint numBits = 0;
+
+    // Per table: slots sorted by code, and their codes.
+    vector<vector<uint>> tableSlots;
+    vector<vector<uint>> tableCodes;
+
+    void project(const SparseArray& vec, uint table, float *projections) const;
+
+    public:
+    // numBits = 0 picks buckets of about 128 slots.
+    void build(const SimilarityIndex& index, uint numTables, uint numBits, ThreadPool& pool);
+    bool isBuilt() const { return index != nullptr; }
+
+    // Approximate top-k meanings by cosine (lowest cosine if reversed) among the given slot ranges.
+    // May return fewer than size meanings.
+    vector<std::pair<ulong, float>> similar(const SparseArray& vec, uint size, bool reversed, const vector<std::pair<uint, uint>>& ranges) const;
+};
+
+#endif
@@ -27,6 +27,9 @@ TDVService::TDVService(cppcms::service &srv): cppcms::application(srv)
     dispatcher().assign("/similarity",&TDVService::similarity,this);
     mapper().assign("similarity","/similarity");
 
+    dispatcher().assign("/similarity/batch",&TDVService::similarityBatch,this);
+    mapper().assign("similarity_batch","/similarity/batch");
+
     dispatcher().assign("/features",&TDVService::features,this);
     mapper().assign("features","/features");
     
@@ -38,20 +41,34 @@ TDVService::TDVService(cppcms::service &srv): cppcms::application(srv)
     
     mapper().root("/tdv");
 
-    string configFileName = settings()["application"]["config_file"].str();
-    MeaningExtractor::config.load(configFileName);
-    
-    wiktdb = new WiktDB();
-    std::cout << "Loading DB..." << std::endl;
-    wiktdb->loadDB(MeaningExtractor::config.wiktDBPath);
-    std::cout << "DB loaded." << std::endl;
-    
-    MeaningExtractor::setDB(wiktdb);
-    
-    std::cout << "Preloading vectors..." << std::endl;
-    MeaningExtractor::loadVectorsFromFile(MeaningExtractor::config.meaningFilePath);;
+    wiktdb = loadData(settings()["application"]["config_file"].str());
+}
 
-    std::cout << "Ready." << std::endl;
+// cppcms creates one application per worker thread. The DB and vectors are loaded by the first one and shared,
+// read-only, by all of them.
+WiktDB *TDVService::loadData(const string& configFileName)
+{
+    static std::once_flag loadFlag;
+    static WiktDB *wiktdb = nullptr;
+
+    std::call_once(loadFlag, [&configFileName]
+    {
+        MeaningExtractor::config.load(configFileName);
+        
+        wiktdb = new WiktDB();
+        std::cout << "Loading DB..." << std::endl;
+        wiktdb->loadDB(MeaningExtractor::config.wiktDBPath, MeaningExtractor::config.wiktDBCacheSize, &MeaningExtractor::threadPool());
+        std::cout << "DB loaded." << std::endl;
+        
+        MeaningExtractor::setDB(wiktdb);
+        
+        std::cout << "Preloading vectors..." << std::endl;
+        MeaningExtractor::loadVectorsFromFile(MeaningExtractor::config.meaningFilePath);
+
+        std::cout << "Ready." << std::endl;
+    });
+
+    return wiktdb;
 }
 
 string TDVService::printRepr(SparseArray vec)
@@ -65,7 +82,7 @@ string TDVService::printRepr(SparseArray vec)
         
         if (idx < wiktdb->size())
         {
-            demoStream << (*wiktdb)[idx]["title"] << ": " << pair.second << "<br/>" << std::endl;
+            demoStream << json(wiktdb->title(idx)) << ": " << pair.second << "<br/>" << std::endl;
         }
         else
         {
@@ -75,7 +92,7 @@ string TDVService::printRepr(SparseArray vec)
                 if (idx < wiktdb->size() * (REPR_OFFSET_BASES[i] + 1))
                 {
                     ulong offset = idx % wiktdb->size();
-                    demoStream << REPR_OFFSET_BASE_NAMES[i] << "(" << (*wiktdb)[offset]["title"] << "): " << pair.second << "<br/>" << std::endl;
+                    demoStream << REPR_OFFSET_BASE_NAMES[i] << "(" << json(wiktdb->title(offset)) << "): " << pair.second << "<br/>" << std::endl;
 
                     skip = true;
                     break;
@@ -134,6 +151,8 @@ void TDVService::similar()
     string pos = request().get("pos");
     string ctx = request().get("ctx");
     string rev = request().get("rev");
+    string lang = request().get("lang");
+    bool approx = (request().get("approx") == "true");
     bool reverse = (rev == "true");
     vector<string> context;
     SparseArray vec;
@@ -155,13 +174,13 @@ void TDVService::similar()
 
     try
     {
-        vector<std::pair<ulong, float>> simList = MeaningExtractor::similarRepr(vec, 20, reverse, pos);
+        vector<std::pair<ulong, float>> simList = MeaningExtractor::similarRepr(vec, 20, reverse, pos, lang, approx);
 
         json res = json::array();
 
         for (auto pair : simList)
         {
-            const Meaning& meaning = MeaningExtractor::reprCache[pair.first];
+            const Meaning& meaning = MeaningExtractor::reprCache.at(pair.first);
             res.push_back(json({{"sim", pair.second}, {"term", meaning.term}, {"pos", meaning.pos}, {"descr", meaning.descr}}));
         }
 
@@ -196,7 +215,7 @@ void TDVService::definition()
 
         for (auto pair : simList)
         {
-            const Meaning& meaning = MeaningExtractor::reprCache[pair.first];
+            const Meaning& meaning = MeaningExtractor::reprCache.at(pair.first);
 
             if(std::find(definition.begin(), definition.end(), meaning.term) != definition.end())
                 continue;
@@ -249,7 +268,7 @@ void TDVService::disambiguation()
     else
         sentence.erase(matchPos, matchPos + term.length() + 1);
 
-    vector<string> context = StringUtils::split(sentence);
+    vector<string> context = StringUtils::splitWhitespace(sentence);
     
     SparseArray vec;
     if (pos != "")
@@ -257,7 +276,7 @@ void TDVService::disambiguation()
     else
         vec = Meaning(term).getVector();
 
-    Meaning& disambigMeaning = MeaningExtractor::disambiguate(term, pos, context);
+    const Meaning& disambigMeaning = MeaningExtractor::disambiguate(term, pos, context);
     
     json res = json::array();
     res.push_back(json({{"term", disambigMeaning.term}, {"pos", disambigMeaning.pos}, {"descr", disambigMeaning.descr}}));
@@ -282,6 +301,49 @@ void TDVService::similarity()
     response().out() <<  MeaningExtractor::similarity(term1, pos1, term2, pos2, vector<string>(), scale) << std::endl;
 }
 
+// POST body: [{"term1": ..., "pos1": ..., "term2": ..., "pos2": ..., "scale": ...}, ...], with pos and scale optional.
+// Responds with the array of similarities, in the same order.
+void TDVService::similarityBatch()
+{
+    setHeaders();
+
+    if (request().request_method() != "POST")
+    {
+        response().out() << "{\"!ERR\": \"POST a JSON array of term pairs\"}";
+        return;
+    }
+
+    vector<SimilarityQuery> queries;
+
+    try
+    {
+        std::pair<void*, size_t> body = request().raw_post_data();
+        json batch = json::parse((const char*)body.first, (const char*)body.first + body.second);
+
+        for (const json& pair : batch)
+        {
+            SimilarityQuery query;
+            query.term1 = pair.at("term1");
+            query.pos1 = pair.value("pos1", "");
+            query.term2 = pair.at("term2");
+            query.pos2 = pair.value("pos2", "");
+            query.scale = pair.value("scale", 1.0);
+
+            if (query.scale < 0.001)
+                query.scale = 1;
+
+            queries.push_back(query);
+        }
+    }
+    catch (std::exception& e)
+    {
+        response().out() << "{\"!ERR\": \"Invalid batch: " << e.what() << "\"}";
+        return;
+    }
+
+    response().out() << json(MeaningExtractor::similarity(queries)) << std::endl;
+}
+
 void TDVService::features()
 {
     string term1 = request().get("term1");
@@ -289,14 +351,12 @@ void TDVService::features()
     string term2 = request().get("term2");
     string pos2 = request().get("pos2");
 
-    SparseArray vec1, vec2;
-    MeaningExtractor::graphFill = true;
-    uint linkSearchDepth = MeaningExtractor::linkSearchDepth;
-    MeaningExtractor::linkSearchDepth = 1;
-    vec1 = Meaning(term1, pos1).getVector();
-    vec2 = Meaning(term2, pos2).getVector();
-    MeaningExtractor::graphFill = false;
-    MeaningExtractor::linkSearchDepth = linkSearchDepth;
+    VectorOptions options;
+    options.graphFill = true;
+    options.linkSearchDepth = 1;
+
+    SparseArray vec1 = MeaningExtractor::getVector(term1, pos1, options);
+    SparseArray vec2 = MeaningExtractor::getVector(term2, pos2, options);
     
     setHeaders();
 
@@ -343,9 +403,9 @@ void TDVService::wiktdef()
     
     if (wiktdb->exists(term))
     {
-        const json& termRef = (*wiktdb)[term];
+        EntryRef termRef = wiktdb->entry(term);
         response().out() <<  
-            termRef << "\n";
+            *termRef << "\n";
     }
     else
     {
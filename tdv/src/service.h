@@ -6,6 +6,7 @@
 #include <cppcms/service.h>
 #include <cstdlib>
 #include <algorithm>
+#include <mutex>
 #include "wiktdb.h"
 #include "sparsearray.h"
 #include "vectorize.h"
@@ -14,6 +15,8 @@
 
 class TDVService : public cppcms::application {
     WiktDB *wiktdb;
+
+    static WiktDB *loadData(const string& configFileName);
     
     public:
     TDVService(cppcms::service &);
@@ -24,6 +27,7 @@ class TDVService : public cppcms::application {
     virtual void definition();
     virtual void repr();
     virtual void similarity();
+    virtual void similarityBatch();
     virtual void features();
     virtual void wiktdef();
     virtual void disambiguation();
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <tuple>
+#include <set>
+#include "similarityindex.h"
+#include "vectorize.h"
+
+// Margin on score bounds, covering the rounding differences between accumulated and exact cosines.
+static const float SIM_BOUND_SLACK = 1e-4;
+
+struct Posting
+{
+    uint dim;
+    uint slot;
+    float weight;
+};
+
+struct SlotKey
+{
+    uint posId;
+    uint langId;
+    ulong id;
+    const Meaning *meaning;
+
+    bool operator< (const SlotKey& other) const
+    {
+        return std::tie(posId, langId, id) < std::tie(other.posId, other.langId, other.id);
+    }
+};
+
+static uint internId(const vector<string>& names, const string& name)
+{
+    return std::lower_bound(names.begin(), names.end(), name) - names.begin();
+}
+
+// Accumulated scores and seen flags by slot, reset after each query.
+static thread_local vector<float> acc;
+static thread_local vector<char> seen;
+
+struct QueryTerm
+{
+    ulong dimIdx;
+    float weight;
+    float upper;
+    float lower;
+};
+
+void SimilarityIndex::build(const umap<ulong, Meaning>& meanings)
+{
+    vector<Posting> postings;
+    vector<SlotKey> slotKeys;
+    set<string> posSet, langSet;
+
+    slotIds.clear();
+    slotMeanings.clear();
+    partitions.clear();
+    dims.clear();
+    dimOffsets.clear();
+    dimMaxWeights.clear();
+    dimMinWeights.clear();
+
+    for (auto it = meanings.begin(); it != meanings.end(); ++it)
+    {
+        posSet.insert(it->second.pos);
+        langSet.insert(it->second.lang);
+    }
+
+    posNames.assign(posSet.begin(), posSet.end());
+    langNames.assign(langSet.begin(), langSet.end());
+
+    for (auto it = meanings.begin(); it != meanings.end(); ++it)
+        slotKeys.push_back(SlotKey{internId(posNames, it->second.pos), internId(langNames, it->second.lang), it->first, &it->second});
+
+    std::sort(slotKeys.begin(), slotKeys.end());
+
+    for (uint slot = 0; slot < slotKeys.size(); slot++)
+    {
+        const SlotKey& key = slotKeys[slot];
+        const Meaning& meaning = *key.meaning;
+        const SparseArray& vec = meaning.repr;
+        float norm = meaning.norm;
+
+        slotIds.push_back(key.id);
+        slotMeanings.push_back(&meaning);
+
+        if (partitions.empty() || partitions.back().posId != key.posId || partitions.back().langId != key.langId)
+            partitions.push_back(Partition{key.posId, key.langId, slot, slot});
+
+        partitions.back().end = slot + 1;
+
+        // Null vectors have cosine 0 with everything, like the meanings that share no dimension with a query.
+        if (!(norm > 0))
+            continue;
+
+        for (size_t i = 0; i < vec.size(); i++)
+        {
+            if (vec.valueData()[i] != 0)
+                postings.push_back(Posting{vec.keyData()[i], slot, vec.valueData()[i] / norm});
+        }
+    }
+
+    // Slots were added in increasing order, so a stable sort keeps each posting list sorted by slot.
+    std::stable_sort(postings.begin(), postings.end(), [](const Posting& a, const Posting& b) { return a.dim < b.dim; });
+
+    postingSlots.resize(postings.size());
+    postingWeights.resize(postings.size());
+
+    for (size_t i = 0; i < postings.size(); i++)
+    {
+        if (i == 0 || postings[i].dim != postings[i - 1].dim)
+        {
+            dims.push_back(postings[i].dim);
+            dimOffsets.push_back(i);
+            dimMaxWeights.push_back(postings[i].weight);
+            dimMinWeights.push_back(postings[i].weight);
+        }
+
+        dimMaxWeights.back() = std::max(dimMaxWeights.back(), postings[i].weight);
+        dimMinWeights.back() = std::min(dimMinWeights.back(), postings[i].weight);
+        postingSlots[i] = postings[i].slot;
+        postingWeights[i] = postings[i].weight;
+    }
+
+    dimOffsets.push_back(postings.size());
+    built = true;
+}
+
+vector<std::pair<uint, uint>> SimilarityIndex::partitionRanges(const string& pos, const string& lang) const
+{
+    vector<std::pair<uint, uint>> ranges;
+    uint posId = internId(posNames, pos);
+    uint langId = internId(langNames, lang);
+
+    // Unknown names match no partition.
+    if ((pos != "" && (posId == posNames.size() || posNames[posId] != pos)) ||
+        (lang != "" && (langId == langNames.size() || langNames[langId] != lang)))
+        return ranges;
+
+    // Partitions are contiguous in slot order: all of them form one range, and adjacent matches are merged
+    // (all the languages of a POS, with only a POS filter), so that queries look up as few ranges as possible.
+    if (pos == "" && lang == "")
+    {
+        if (!slotIds.empty())
+            ranges.push_back(std::make_pair(0u, (uint)slotIds.size()));
+
+        return ranges;
+    }
+
+    for (const Partition& partition : partitions)
+    {
+        if ((pos != "" && partition.posId != posId) || (lang != "" && partition.langId != langId))
+            continue;
+
+        if (!ranges.empty() && ranges.back().second == partition.begin)
+            ranges.back().second = partition.end;
+        else
+            ranges.push_back(std::make_pair(partition.begin, partition.end));
+    }
+
+    return ranges;
+}
+
+vector<std::pair<uint, uint>> SimilarityIndex::shardRanges(const vector<std::pair<uint, uint>>& ranges, uint shard, uint numShards)
+{
+    vector<std::pair<uint, uint>> shardRanges;
+    ulong numSlots = 0;
+    ulong rangeStart = 0;
+
+    for (const std::pair<uint, uint>& range : ranges)
+        numSlots += range.second - range.first;
+
+    // Shard slots are [first, last) in the concatenation of the ranges.
+    ulong first = numSlots * shard / numShards;
+    ulong last = numSlots * (shard + 1) / numShards;
+
+    for (const std::pair<uint, uint>& range : ranges)
+    {
+        ulong rangeEnd = rangeStart + range.second - range.first;
+        ulong begin = std::max(first, rangeStart);
+        ulong end = std::min(last, rangeEnd);
+
+        if (begin < end)
+            shardRanges.push_back(std::make_pair(range.first + (begin - rangeStart), range.first + (end - rangeStart)));
+
+        rangeStart = rangeEnd;
+    }
+
+    return shardRanges;
+}
+
+vector<std::pair<ulong, float>> SimilarityIndex::similar(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang) const
+{
+    TopK topK(size, reversed);
+
+    similar(vec, size, reversed, partitionRanges(pos, lang), topK);
+
+    return topK.results();
+}
+
+// size-th highest accumulated score of the touched slots (size <= touched.size()).
+static float kthScore(const vector<uint>& touched, uint size)
+{
+    static thread_local vector<float> scores;
+
+    scores.resize(touched.size());
+
+    for (size_t i = 0; i < touched.size(); i++)
+        scores[i] = acc[touched[i]];
+
+    std::nth_element(scores.begin(), scores.begin() + size - 1, scores.end(), std::greater<float>());
+
+    return scores[size - 1];
+}
+
+void SimilarityIndex::similar(const SparseArray& vec, uint size, bool reversed, const vector<std::pair<uint, uint>>& ranges, TopK& topK) const
+{
+    const float sign = reversed ? -1.0 : 1.0;
+    const size_t numSlots = slotIds.size();
+    vector<QueryTerm> terms;
+    vector<uint> touched;
+    float qNorm = vec.norm();
+
+    if (size == 0 || ranges.empty())
+        return;
+
+    if (qNorm > 0)
+    {
+        for (size_t i = 0; i < vec.size(); i++)
+        {
+            uint dim = vec.keyData()[i];
+            auto dimIt = std::lower_bound(dims.begin(), dims.end(), dim);
+
+            if (vec.valueData()[i] == 0 || dimIt == dims.end() || *dimIt != dim)
+                continue;
+
+            // Reversed queries rank by the negated cosine, which has the same bounds as a negated query.
+            ulong dimIdx = dimIt - dims.begin();
+            float weight = sign * vec.valueData()[i] / qNorm;
+            float maxContrib = weight * dimMaxWeights[dimIdx];
+            float minContrib = weight * dimMinWeights[dimIdx];
+
+            terms.push_back(QueryTerm{dimIdx, weight, std::max(std::max(maxContrib, minContrib), 0.0f), std::min(std::min(maxContrib, minContrib), 0.0f)});
+        }
+    }
+
+    std::sort(terms.begin(), terms.end(), [](const QueryTerm& a, const QueryTerm& b) { return a.upper > b.upper; });
+
+    if (acc.size() < numSlots)
+    {
+        acc.resize(numSlots, 0.0);
+        seen.resize(numSlots, 0);
+    }
+
+    // Suffix sums of the term bounds: the most (least) that the terms from t on can still add to a score.
+    vector<float> remUppers(terms.size() + 1, 0.0);
+    vector<float> remLowers(terms.size() + 1, 0.0);
+
+    for (size_t r = terms.size(); r-- > 0;)
+    {
+        remUppers[r] = remUppers[r + 1] + terms[r].upper;
+        remLowers[r] = remLowers[r + 1] + terms[r].lower;
+    }
+
+    // Score-at-a-time accumulation. Partial scores plus the bounds of the remaining terms bracket the final score.
+    // The lower bound of a score only grows as terms are added (each adds at least its lower bound), so a threshold
+    // taken earlier stays valid: it is only recomputed once the postings scanned since then outnumber the touched
+    // slots, which keeps its cost linear in the postings scanned.
+    bool admitNew = true;
+    bool hasThreshold = false;
+    float threshold = -std::numeric_limits<float>::max();
+    ulong numScanned = 0;
+    size_t t = 0;
+
+    while (t < terms.size() && admitNew)
+    {
+        const QueryTerm& term = terms[t];
+        const uint *listBegin = postingSlots.data() + dimOffsets[term.dimIdx];
+        const uint *listEnd = postingSlots.data() + dimOffsets[term.dimIdx + 1];
+
+        // Posting lists are sorted by slot: only the part within the partitions is scanned.
+        for (const std::pair<uint, uint>& range : ranges)
+        {
+            for (const uint *it = std::lower_bound(listBegin, listEnd, range.first); it != listEnd && *it < range.second; ++it)
+            {
+                uint slot = *it;
+
+                if (!seen[slot])
+                {
+                    seen[slot] = 1;
+                    touched.push_back(slot);
+                }
+
+                acc[slot] += term.weight * postingWeights[it - postingSlots.data()];
+                numScanned++;
+            }
+        }
+
+        t++;
+
+        if (touched.size() >= size && numScanned >= touched.size())
+        {
+            threshold = kthScore(touched, size) + remLowers[t];
+            hasThreshold = true;
+            numScanned = 0;
+        }
+
+        // Meanings not seen yet score at most remUppers[t] (0 if they share no dimension at all).
+        if (hasThreshold && remUppers[t] < threshold - SIM_BOUND_SLACK)
+            admitNew = false;
+    }
+
+    float remUpper = remUppers[t];
+
+    // Tightest threshold for the candidates, before rescoring them.
+    if (touched.size() >= size)
+    {
+        threshold = kthScore(touched, size) + remLowers[t];
+        hasThreshold = true;
+    }
+
+    for (uint slot : touched)
+    {
+        if (!hasThreshold || acc[slot] + remUpper >= threshold - SIM_BOUND_SLACK)
+            topK.push(slotIds[slot], SparseArray::cosine(vec, slotMeanings[slot]->repr, qNorm, slotMeanings[slot]->norm));
+    }
+
+    // Meanings sharing no dimension with the query have cosine exactly 0, and are ranked among the others by meaning ID.
+    // They can only rank if every term was processed, otherwise the threshold is already above them.
+    // Partitions are sorted by meaning ID, so the first unseen slots of each one within the ranges are the candidates.
+    if (admitNew)
+    {
+        for (const std::pair<uint, uint>& range : ranges)
+        {
+            auto partIt = std::upper_bound(partitions.begin(), partitions.end(), range.first,
+                                           [](uint slot, const Partition& partition) { return slot < partition.end; });
+
+            for (; partIt != partitions.end() && partIt->begin < range.second; ++partIt)
+            {
+                uint end = std::min(range.second, partIt->end);
+                uint numZeros = 0;
+
+                for (uint slot = std::max(range.first, partIt->begin); slot < end && numZeros < size; slot++)
+                {
+                    if (!seen[slot])
+                    {
+                        topK.push(slotIds[slot], 0.0);
+                        numZeros++;
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint slot : touched)
+    {
+        acc[slot] = 0.0;
+        seen[slot] = 0;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef SIMILARITYINDEX_H
+#define SIMILARITYINDEX_H
+#include <utility>
+#include "types.h"
+#include "sparsearray.h"
+
+class Meaning;
+class TopK;
+
+// Inverted index (dimension -> postings) over the cached meaning vectors, for exact top-k cosine queries.
+// Queries accumulate scores term-at-a-time, in decreasing order of each term's score bound, and stop
+// admitting new candidates once the remaining bound cannot reach the current k-th best score (MaxScore).
+// Surviving candidates are rescored with SparseArray::cosine, so results match the exhaustive scan exactly.
+class SimilarityIndex
+{
+    // Contiguous slot range of the meanings with the same POS and language.
+    struct Partition
+    {
+        uint posId;
+        uint langId;
+        uint begin;
+        uint end;
+    };
+
+    // Slots are meanings sorted by POS, language and meaning ID, so each partition is sorted by meaning ID.
+    vector<ulong> slotIds;
+    vector<const Meaning*> slotMeanings;
+
+    // Interned POS and language names (sorted; IDs are positions) and the partitions, in slot order.
+    vector<string> posNames;
+    vector<string> langNames;
+    vector<Partition> partitions;
+
+    // Posting lists of each non-zero dimension, weights normalized by the meaning vector norm.
+    vector<uint> dims;
+    vector<ulong> dimOffsets;
+    vector<float> dimMaxWeights;
+    vector<float> dimMinWeights;
+    vector<uint> postingSlots;
+    vector<float> postingWeights;
+
+    bool built = false;
+
+    public:
+    void build(const umap<ulong, Meaning>& meanings);
+    bool isBuilt() const { return built; }
+    size_t size() const { return slotIds.size(); }
+
+    ulong slotId(uint slot) const { return slotIds[slot]; }
+    const Meaning& slotMeaning(uint slot) const { return *slotMeanings[slot]; }
+
+    // Sorted slot ranges [first, second) of the partitions matching the given POS and language (empty matches all),
+    // adjacent partitions merged.
+    vector<std::pair<uint, uint>> partitionRanges(const string& pos, const string& lang) const;
+
+    // Splits the slot ranges in numShards parts with about the same number of slots, and returns the given part.
+    static vector<std::pair<uint, uint>> shardRanges(const vector<std::pair<uint, uint>>& ranges, uint shard, uint numShards);
+
+    // Top-k meanings by cosine (lowest cosine if reversed), ties by meaning ID. Only the partitions matching
+    // pos and lang (empty matches all) are scanned.
+    vector<std::pair<ulong, float>> similar(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang) const;
+    // Adds the top-k meanings of the given sorted, disjoint slot ranges to topK.
+    // Queries over disjoint ranges may run in parallel, and their selections be merged.
+    void similar(const SparseArray& vec, uint size, bool reversed, const vector<std::pair<uint, uint>>& ranges, TopK& topK) const;
+};
+
+#endif
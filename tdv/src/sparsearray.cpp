@@ -1,9 +1,242 @@
 #include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
 #include "sparsearray.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPARSEARRAY_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Size ratio above which intersections gallop through the larger key array instead of merging.
+const size_t GALLOP_MIN_RATIO = 32;
+// Smaller array size from which the AVX2 kernel beats the SSE one; below it the wider blocks mostly cost a longer
+// scalar tail (meaning vectors have ~15 keys).
+const size_t AVX2_MIN_SIZE = 1024;
+
+// First position in [pos, size) with keys[pos] >= key, searching with exponentially growing steps from pos.
+static size_t gallop(const uint *keys, size_t pos, size_t size, uint key)
+{
+    size_t step = 1;
+    size_t hi = pos;
+
+    while (hi < size && keys[hi] < key)
+    {
+        pos = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+
+    return std::lower_bound(keys + pos, keys + std::min(hi, size), key) - keys;
+}
+
+// Scalar merge of a[i..aSize) and b[j..bSize).
+template <class Match>
+static void intersectMerge(const uint *a, size_t aSize, const uint *b, size_t bSize, size_t i, size_t j, Match& match)
+{
+    while (i < aSize && j < bSize)
+    {
+        if (a[i] < b[j])
+            i++;
+        else if (b[j] < a[i])
+            j++;
+        else
+            match(i++, j++);
+    }
+}
+
+#ifdef SPARSEARRAY_X86_SIMD
+// Reports the matches of a block compare: bit k of mask is set if a[i + k] is in b[j..j + width).
+template <class Match>
+static inline void blockMatches(const uint *a, size_t i, const uint *b, size_t j, int mask, Match& match)
+{
+    for (size_t k = 0; mask; k++, mask >>= 1)
+    {
+        if (mask & 1)
+        {
+            while (b[j] != a[i + k])
+                j++;
+
+            match(i + k, j);
+        }
+    }
+}
+
+// Block merge of a[i..aSize) and b[j..bSize) comparing 4 keys of each array at once (all pairs through 3
+// rotations of the b block). The 32-bit compares only need SSE2, which every x86-64 CPU has.
+template <class Match>
+static void intersectSSE(const uint *a, size_t aSize, const uint *b, size_t bSize, size_t i, size_t j, Match& match)
+{
+    while (i + 4 <= aSize && j + 4 <= bSize)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+
+        __m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                                               _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+                                  _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                                               _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+
+        if (mask)
+            blockMatches(a, i, b, j, mask, match);
+
+        uint aLast = a[i + 3], bLast = b[j + 3];
+
+        if (aLast <= bLast)
+            i += 4;
+        if (bLast <= aLast)
+            j += 4;
+    }
+
+    intersectMerge(a, aSize, b, bSize, i, j, match);
+}
+
+// Same as intersectSSE, with blocks of 8 keys. Only pays off on large arrays: see AVX2_MIN_SIZE.
+template <class Match>
+__attribute__((target("avx2")))
+static void intersectAVX2(const uint *a, size_t aSize, const uint *b, size_t bSize, Match& match)
+{
+    size_t i = 0, j = 0;
+
+    while (i + 8 <= aSize && j + 8 <= bSize)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        // In-lane rotations of b and of b with its 128-bit lanes swapped cover all 8x8 pairs.
+        __m256i vs = _mm256_permute2x128_si256(vb, vb, 1);
+
+        __m256i eq = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi32(va, vb),
+                                            _mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+                            _mm256_or_si256(_mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                                            _mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))))),
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi32(va, vs),
+                                            _mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vs, _MM_SHUFFLE(0, 3, 2, 1)))),
+                            _mm256_or_si256(_mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vs, _MM_SHUFFLE(1, 0, 3, 2))),
+                                            _mm256_cmpeq_epi32(va, _mm256_shuffle_epi32(vs, _MM_SHUFFLE(2, 1, 0, 3))))));
+
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+
+        if (mask)
+            blockMatches(a, i, b, j, mask, match);
+
+        uint aLast = a[i + 7], bLast = b[j + 7];
+
+        if (aLast <= bLast)
+            i += 8;
+        if (bLast <= aLast)
+            j += 8;
+    }
+
+    intersectSSE(a, aSize, b, bSize, i, j, match);
+}
+#endif
+
+static bool intersectKernelSupported(SparseArray::IntersectKernel kernel)
+{
+    switch (kernel)
+    {
+        case SparseArray::IntersectKernel::scalar:
+            return true;
+#ifdef SPARSEARRAY_X86_SIMD
+        case SparseArray::IntersectKernel::sse:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case SparseArray::IntersectKernel::avx2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+static SparseArray::IntersectKernel detectIntersectKernel()
+{
+    if (intersectKernelSupported(SparseArray::IntersectKernel::avx2))
+        return SparseArray::IntersectKernel::avx2;
+    if (intersectKernelSupported(SparseArray::IntersectKernel::sse))
+        return SparseArray::IntersectKernel::sse;
+
+    return SparseArray::IntersectKernel::scalar;
+}
+
+static SparseArray::IntersectKernel activeIntersectKernel = detectIntersectKernel();
+
+SparseArray::IntersectKernel SparseArray::intersectKernel()
+{
+    return activeIntersectKernel;
+}
+
+bool SparseArray::setIntersectKernel(IntersectKernel kernel)
+{
+    if (!intersectKernelSupported(kernel))
+        return false;
+
+    activeIntersectKernel = kernel;
+    return true;
+}
+
+const char* SparseArray::intersectKernelName(IntersectKernel kernel)
+{
+    switch (kernel)
+    {
+        case IntersectKernel::sse:
+            return "sse";
+        case IntersectKernel::avx2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+// Calls match(i, j) for every key with a.keys[i] == b.keys[j], in increasing key order. No allocation.
+template <class Match>
+static void intersect(const vector<uint>& aKeys, const vector<uint>& bKeys, Match match)
+{
+    const uint *a = aKeys.data();
+    const uint *b = bKeys.data();
+    size_t aSize = aKeys.size(), bSize = bKeys.size();
+    size_t i = 0, j = 0;
+
+    if (aSize * GALLOP_MIN_RATIO < bSize)
+    {
+        for (; i < aSize && j < bSize; i++)
+        {
+            j = gallop(b, j, bSize, a[i]);
+            if (j < bSize && b[j] == a[i])
+                match(i, j++);
+        }
+    }
+    else if (bSize * GALLOP_MIN_RATIO < aSize)
+    {
+        for (; j < bSize && i < aSize; j++)
+        {
+            i = gallop(a, i, aSize, b[j]);
+            if (i < aSize && a[i] == b[j])
+                match(i++, j);
+        }
+    }
+#ifdef SPARSEARRAY_X86_SIMD
+    else if (activeIntersectKernel == SparseArray::IntersectKernel::avx2 && std::min(aSize, bSize) >= AVX2_MIN_SIZE)
+        intersectAVX2(a, aSize, b, bSize, match);
+    else if (activeIntersectKernel != SparseArray::IntersectKernel::scalar)
+        intersectSSE(a, aSize, b, bSize, i, j, match);
+#endif
+    else
+        intersectMerge(a, aSize, b, bSize, i, j, match);
+}
+
 float SparseArray::cosine(const SparseArray& a, const SparseArray& b)
 {
-    float cos =  ((a * b) / (a.norm() * b.norm()));
+    return cosine(a, b, a.norm(), b.norm());
+}
+
+float SparseArray::cosine(const SparseArray& a, const SparseArray& b, float normA, float normB)
+{
+    float cos =  ((a * b) / (normA * normB));
 
     // Clipping underflow to zero.
     if (!std::isnan(cos))
@@ -17,24 +250,17 @@ float SparseArray::weightedCosine(const SparseArray& a, const SparseArray& b, fl
     float norm = a.norm() * b.norm();
     float dot = 0;
 
-    size_t aSize = a.size();
-    size_t bSize = b.size();
-    auto big = (aSize > bSize) ? a : b;
-    auto small = (big == a) ? b : a;
-
-    for (auto it = small.begin(); it != small.end(); ++it)
+    // Products are summed in key order, as iterating the smaller array did.
+    intersect(a.keys, b.keys, [&](size_t i, size_t j)
     {
-        if (big.count(it->first))
-        {
-            float prod = it->second * big.at(it->first);
-            if (prod >= 0)
-                prod *= positiveWeight;
-            else
-                prod *= negativeWeight;
+        float prod = a.values[i] * b.values[j];
+        if (prod >= 0)
+            prod *= positiveWeight;
+        else
+            prod *= negativeWeight;
 
-            dot += prod;
-        }
-    }
+        dot += prod;
+    });
 
     float cos = dot / norm;
 
@@ -50,9 +276,9 @@ float SparseArray::norm() const
 {
     float sqrSum = 0;
 
-    for (auto it = this->begin(); it != this->end(); ++it)
+    for (float value : values)
     {
-        sqrSum += it->second * it->second;
+        sqrSum += value * value;
     }
 
     return sqrt(sqrSum);
@@ -61,18 +287,8 @@ float SparseArray::norm() const
 size_t SparseArray::keyIntersectionSize(const SparseArray& a, const SparseArray& b)
 {
     size_t size = 0;
-    size_t aSize = a.size();
-    size_t bSize = b.size();
-    auto big = (aSize > bSize) ? a : b;
-    auto small = (big == a) ? b : a;
 
-    for (auto it = small.begin(); it != small.end(); ++it)
-    {
-        if (big.count(it->first))
-        {
-            size++;
-        }
-    }
+    intersect(a.keys, b.keys, [&size](size_t i, size_t j) { size++; });
 
     return size;
 }
@@ -82,10 +298,10 @@ void SparseArray::toCArray(float *v, ulong size) const
     for (ulong i = 0; i < size; i++)
         v[i] = 0;
 
-    for (auto it = this->begin(); it != this->end(); ++it)
+    for (size_t i = 0; i < keys.size(); i++)
     {
-        if (it->first < size)
-            v[it->first] = it->second;
+        if (keys[i] < size)
+            v[keys[i]] = values[i];
     }
 }
 
@@ -96,35 +312,129 @@ SparseArray SparseArray::fromCArray(const float *v, ulong size, float thresholdM
     for (ulong i = 0; i < size; i++)
     {
         if (v[i] >= thresholdMin)
-            sv[i] = v[i];
+        {
+            sv.keys.push_back(i);
+            sv.values.push_back(v[i]);
+        }
     }
 
     return sv;
 }
 
+SparseArray SparseArray::fromSortedArrays(const uint *keys, const float *values, size_t size)
+{
+    SparseArray sv;
+    sv.keys.assign(keys, keys + size);
+    sv.values.assign(values, values + size);
+
+    return sv;
+}
+
+size_t SparseArray::lowerBound(ulong k) const
+{
+    return std::lower_bound(keys.begin(), keys.end(), k) - keys.begin();
+}
+
 float SparseArray::get(const ulong& k) const
 {
-    if (count(k))
-        return this->at(k);
+    size_t pos = lowerBound(k);
+
+    if (pos < keys.size() && keys[pos] == k)
+        return values[pos];
     else
         return 0.0;
-} 
+}
+
+float& SparseArray::at(const ulong& k)
+{
+    return const_cast<float&>(static_cast<const SparseArray&>(*this).at(k));
+}
+
+const float& SparseArray::at(const ulong& k) const
+{
+    size_t pos = lowerBound(k);
+
+    if (pos < keys.size() && keys[pos] == k)
+        return values[pos];
+
+    throw std::out_of_range("SparseArray::at: key not found");
+}
+
+size_t SparseArray::count(const ulong& k) const
+{
+    size_t pos = lowerBound(k);
+
+    return (pos < keys.size() && keys[pos] == k) ? 1 : 0;
+}
+
+float& SparseArray::operator[] (const ulong& k)
+{
+    size_t pos = lowerBound(k);
+
+    if (pos < keys.size() && keys[pos] == k)
+        return values[pos];
+
+    if (k > std::numeric_limits<uint>::max())
+        throw std::out_of_range("SparseArray: key exceeds 32 bits");
+
+    keys.insert(keys.begin() + pos, k);
+    values.insert(values.begin() + pos, 0.0);
+
+    return values[pos];
+}
+
+void SparseArray::clear()
+{
+    keys.clear();
+    values.clear();
+}
+
+void SparseArray::shrinkToFit()
+{
+    keys.shrink_to_fit();
+    values.shrink_to_fit();
+}
 
 // Sparse array sum.
 SparseArray& SparseArray::operator+= (const SparseArray& other)
 {
-    for (auto it = other.begin(); it != other.end(); ++it)
+    if (other.empty())
+        return *this;
+
+    vector<uint> sumKeys;
+    vector<float> sumValues;
+    size_t i = 0, j = 0;
+
+    sumKeys.reserve(keys.size() + other.keys.size());
+    sumValues.reserve(keys.size() + other.keys.size());
+
+    while (i < keys.size() && j < other.keys.size())
     {
-        if (this->count(it->first))
+        if (keys[i] < other.keys[j])
         {
-            (*this)[it->first] += it->second;
+            sumKeys.push_back(keys[i]);
+            sumValues.push_back(values[i++]);
+        }
+        else if (other.keys[j] < keys[i])
+        {
+            sumKeys.push_back(other.keys[j]);
+            sumValues.push_back(other.values[j++]);
         }
         else
         {
-            (*this)[it->first] = it->second;
+            sumKeys.push_back(keys[i]);
+            sumValues.push_back(values[i++] + other.values[j++]);
         }
     }
 
+    sumKeys.insert(sumKeys.end(), keys.begin() + i, keys.end());
+    sumValues.insert(sumValues.end(), values.begin() + i, values.end());
+    sumKeys.insert(sumKeys.end(), other.keys.begin() + j, other.keys.end());
+    sumValues.insert(sumValues.end(), other.values.begin() + j, other.values.end());
+
+    keys.swap(sumKeys);
+    values.swap(sumValues);
+
     return *this;
 }
 
@@ -133,27 +443,21 @@ SparseArray SparseArray::operator+ (const SparseArray& other) const
     return SparseArray(*this) += other;
 }
 
-// Dot product.
+// Dot product (intersection of the sorted keys).
 float SparseArray::operator* (const SparseArray& other) const
 {
     float dot = 0;
 
-    for (auto it = this->begin(); it != this->end(); ++it)
-    {
-        if (other.count(it->first))
-        {
-            dot += it->second * other.at(it->first);
-        }
-    }
+    intersect(keys, other.keys, [&](size_t i, size_t j) { dot += values[i] * other.values[j]; });
 
     return dot;
 }
 
 SparseArray& SparseArray::operator/= (float div)
 {
-    for (auto it = this->begin(); it != this->end(); ++it)
+    for (float& value : values)
     {
-        (*this)[it->first] /= div;
+        value /= div;
     }
 
     return *this;
@@ -164,4 +468,3 @@ SparseArray SparseArray::operator/ (float div) const
 {
     return SparseArray(*this) /= div;
 }
-
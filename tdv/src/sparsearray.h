@@ -1,14 +1,62 @@
 #ifndef SPARSEARRAY_H
 #define SPARSEARRAY_H
-#include <map>
 #include "types.h"
 
-class SparseArray : public std::map<ulong, float>
+// Key/value view of a sparse array element, with the same member names as std::map's value_type.
+template <class Value>
+struct SparseEntry
 {
-    typedef umap<ulong, float> super;
+    const uint& first;
+    Value& second;
+};
+
+// Position based iterator: elements inserted while iterating do not invalidate it.
+template <class Array, class Value>
+class SparseIterator
+{
+    Array *array;
+    size_t pos;
+
+    public:
+    struct Pointer
+    {
+        SparseEntry<Value> entry;
+        SparseEntry<Value>* operator-> () { return &entry; }
+    };
+
+    SparseIterator(Array *array, size_t pos) : array(array), pos(pos) {}
+
+    SparseEntry<Value> operator* () const { return SparseEntry<Value>{array->keyData()[pos], array->valueData()[pos]}; }
+    Pointer operator-> () const { return Pointer{**this}; }
+    SparseIterator& operator++ () { pos++; return *this; }
+    bool operator== (const SparseIterator& other) const { return pos == other.pos; }
+    bool operator!= (const SparseIterator& other) const { return pos != other.pos; }
+};
+
+// Sparse vector stored as sorted 32-bit key and float value arrays, side by side.
+class SparseArray
+{
+    vector<uint> keys;
+    vector<float> values;
+
+    size_t lowerBound(ulong k) const;
 
     public:
-    static float cosine(const SparseArray& a, const SparseArray& b); 
+    typedef SparseIterator<SparseArray, float> iterator;
+    typedef SparseIterator<const SparseArray, const float> const_iterator;
+
+    // Key intersection kernels behind the dot product, cosines and keyIntersectionSize.
+    // The fastest one supported by the CPU is picked at startup.
+    enum class IntersectKernel { scalar, sse, avx2 };
+
+    static IntersectKernel intersectKernel();
+    // Returns false (keeping the current kernel) if the CPU does not support the requested one.
+    static bool setIntersectKernel(IntersectKernel kernel);
+    static const char* intersectKernelName(IntersectKernel kernel);
+
+    static float cosine(const SparseArray& a, const SparseArray& b);
+    // Cosine with precomputed norms (e.g. Meaning::norm).
+    static float cosine(const SparseArray& a, const SparseArray& b, float normA, float normB);
     static float weightedCosine(const SparseArray& a, const SparseArray& b, float positiveWeight, float negativeWeight);
 
     // Euclidean norm.
@@ -16,20 +64,41 @@ class SparseArray : public std::map<ulong, float>
 
     // Size of key intersection.
     static size_t keyIntersectionSize(const SparseArray& a, const SparseArray& b);
-    
+
     //Conversion to plain C array.
     void toCArray(float *v, ulong size) const;
     static SparseArray fromCArray(const float *v, ulong size, float thresholdMin);
-    
+    // Keys must be sorted in increasing order.
+    static SparseArray fromSortedArrays(const uint *keys, const float *values, size_t size);
+
     float get(const ulong& k) const;
+    float& at(const ulong& k);
+    const float& at(const ulong& k) const;
+    size_t count(const ulong& k) const;
+    float& operator[] (const ulong& k);
+
+    size_t size() const { return keys.size(); }
+    bool empty() const { return keys.empty(); }
+    void clear();
+    // Releases spare capacity left by incremental construction.
+    void shrinkToFit();
+
+    const uint* keyData() const { return keys.data(); }
+    const float* valueData() const { return values.data(); }
+    float* valueData() { return values.data(); }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, keys.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, keys.size()); }
 
     // Sparse array sum.
-    SparseArray operator+ (const SparseArray& other) const; 
+    SparseArray operator+ (const SparseArray& other) const;
     SparseArray& operator+= (const SparseArray& other);
 
     // Dot product.
-    float operator* (const SparseArray& other) const; 
-    
+    float operator* (const SparseArray& other) const;
+
     SparseArray& operator/= (float div);
     SparseArray operator/ (float div) const;
 };
@@ -33,24 +33,157 @@ std::vector<std::string> StringUtils::escapeStrings(const std::vector<std::strin
     return VectorUtils::map<std::string>(delimiters, escapeString);
 }
 
+size_t Tokenizer::whitespaceSize(const char *str, size_t size)
+{
+    unsigned char c0 = str[0];
+
+    switch (c0)
+    {
+        case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+            return 1;
+        // U+0085, U+00A0
+        case 0xC2:
+            return (size >= 2 && ((unsigned char)str[1] == 0x85 || (unsigned char)str[1] == 0xA0)) ? 2 : 0;
+        default:
+            break;
+    }
+
+    if (size < 3 || c0 < 0xE1 || c0 > 0xE3)
+        return 0;
+
+    unsigned char c1 = str[1];
+    unsigned char c2 = str[2];
+
+    // U+1680
+    if (c0 == 0xE1)
+        return (c1 == 0x9A && c2 == 0x80) ? 3 : 0;
+    // U+3000
+    if (c0 == 0xE3)
+        return (c1 == 0x80 && c2 == 0x80) ? 3 : 0;
+    // U+2000 to U+200A, U+2028, U+2029, U+202F
+    if (c1 == 0x80)
+        return ((c2 >= 0x80 && c2 <= 0x8A) || c2 == 0xA8 || c2 == 0xA9 || c2 == 0xAF) ? 3 : 0;
+    // U+205F
+    if (c1 == 0x81)
+        return (c2 == 0x9F) ? 3 : 0;
+
+    return 0;
+}
+
+size_t Tokenizer::delimiterSize(size_t at) const
+{
+    if (delimiters == nullptr)
+        return (delimiter.size <= size - at && std::memcmp(data + at, delimiter.data, delimiter.size) == 0) ? delimiter.size : 0;
+
+    for (const std::string& delim : *delimiters)
+    {
+        if (!delim.empty() && delim.size() <= size - at && std::memcmp(data + at, delim.data(), delim.size()) == 0)
+            return delim.size();
+    }
+
+    return 0;
+}
+
+bool Tokenizer::next(StringRef& token)
+{
+    if (done)
+        return false;
+
+    if (whitespace)
+    {
+        size_t wsSize;
+
+        while (pos < size && (wsSize = whitespaceSize(data + pos, size - pos)) > 0)
+            pos += wsSize;
+
+        size_t start = pos;
+
+        while (pos < size && whitespaceSize(data + pos, size - pos) == 0)
+            pos++;
+
+        token = StringRef(data + start, pos - start);
+        done = (pos == size);
+
+        return start < pos;
+    }
+
+    size_t start = pos;
+
+    // An empty delimiter never matches.
+    if (delimiters != nullptr || !delimiter.empty())
+    {
+        while (pos < size)
+        {
+            size_t delimSize;
+
+            if (delimiters == nullptr)
+            {
+                // Single delimiter: jump to the next occurrence of its first character.
+                const void *hit = std::memchr(data + pos, delimiter.data[0], size - pos);
+
+                if (hit == nullptr)
+                {
+                    pos = size;
+                    break;
+                }
+
+                pos = (const char *)hit - data;
+            }
+
+            if ((delimSize = delimiterSize(pos)) > 0)
+            {
+                token = StringRef(data + start, pos - start);
+                pos += delimSize;
+                matched = true;
+
+                return true;
+            }
+
+            pos++;
+        }
+    }
+
+    done = true;
+
+    // A string without delimiters is a single token, even if empty. A trailing empty token is dropped.
+    if (!matched || start < size)
+    {
+        token = StringRef(data + start, size - start);
+        return true;
+    }
+
+    return false;
+}
+
+static std::vector<std::string> collectTokens(Tokenizer tokenizer)
+{
+    std::vector<std::string> tokens;
+    StringRef token;
+
+    while (tokenizer.next(token))
+        tokens.push_back(token.str());
+
+    return tokens;
+}
+
 std::vector<std::string> StringUtils::split(const std::string & str, const std::vector<std::string> & delimiters) 
 {
-    std::regex rgx(join(escapeStrings(delimiters), "|"));
-    std::sregex_token_iterator first{begin(str), end(str), rgx, -1}, last;
-    
-    return{first, last};
+    return collectTokens(Tokenizer(str, delimiters));
 }
 
 std::vector<std::string> StringUtils::split(const std::string & str, const std::string & delimiter) 
 {
-    std::vector<std::string> delimiters = {delimiter};
-    
-    return split(str, delimiters);
+    return collectTokens(Tokenizer(str, StringRef(delimiter)));
 }
 
 std::vector<std::string> StringUtils::split(const std::string & str) 
 {
-    return split(str, " ");
+    return collectTokens(Tokenizer(str, " "));
+}
+
+std::vector<std::string> StringUtils::splitWhitespace(const std::string & str) 
+{
+    return collectTokens(Tokenizer::whitespaceTokenizer(str));
 }
 
 std::string StringUtils::join(const std::vector<std::string> & tokens, const std::string & delimiter) 
@@ -65,6 +198,37 @@ std::string StringUtils::join(const std::vector<std::string> & tokens, const std
     return stream.str();
 }
 
+std::string StringUtils::stripTemplates(const std::string& str)
+{
+    std::string stripped;
+    size_t copied = 0;
+    size_t pos = 0;
+
+    while ((pos = str.find("{{", pos)) != std::string::npos)
+    {
+        // "{{", one or more characters other than '}', then "}}".
+        size_t close = str.find('}', pos + 2);
+
+        if (close != std::string::npos && close > pos + 2 && close + 1 < str.size() && str[close + 1] == '}')
+        {
+            stripped.append(str, copied, pos - copied);
+            pos = close + 2;
+            copied = pos;
+        }
+        else
+        {
+            pos++;
+        }
+    }
+
+    if (copied == 0)
+        return str;
+
+    stripped.append(str, copied, std::string::npos);
+
+    return stripped;
+}
+
 std::string StringUtils::toLower(const std::string& str)
 {
     std::locale loc;
@@ -6,8 +6,60 @@
 #include <cstdlib>
 #include <vector>
 #include <unordered_map>
-#include <regex>
 #include <sstream>
+#include <cstring>
+
+// Non-owning slice of a character buffer (C++11 has no std::string_view). The buffer must outlive it.
+struct StringRef
+{
+    const char *data;
+    size_t size;
+
+    StringRef() : data(nullptr), size(0) {}
+    StringRef(const char *data, size_t size) : data(data), size(size) {}
+    StringRef(const char *str) : data(str), size(std::strlen(str)) {}
+    StringRef(const std::string& str) : data(str.data()), size(str.size()) {}
+
+    bool empty() const { return size == 0; }
+    std::string str() const { return std::string(data, size); }
+    void assignTo(std::string& str) const { str.assign(data, size); }
+
+    bool operator== (const StringRef& other) const { return size == other.size && std::memcmp(data, other.data, size) == 0; }
+    bool operator!= (const StringRef& other) const { return !(*this == other); }
+};
+
+// Splits a string into slices of its buffer, one per call to next(), without allocating.
+// Delimiter tokenizers follow StringUtils::split. The whitespace tokenizer splits on runs of ASCII and UTF-8 encoded
+// Unicode whitespace, and gives no empty tokens. The string and delimiters must outlive the tokenizer.
+class Tokenizer
+{
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+    bool matched = false;
+    bool done = false;
+    bool whitespace = false;
+    StringRef delimiter;
+    const std::vector<std::string> *delimiters = nullptr;
+
+    explicit Tokenizer(const std::string& str) : data(str.data()), size(str.size()), whitespace(true) {}
+
+    size_t delimiterSize(size_t at) const;
+
+    public:
+    Tokenizer(const std::string& str, StringRef delimiter) : data(str.data()), size(str.size()), delimiter(delimiter) {}
+    Tokenizer(const std::string& str, const std::vector<std::string>& delimiters) : data(str.data()), size(str.size()), delimiters(&delimiters) {}
+    Tokenizer(std::string&& str, StringRef delimiter) = delete;
+    Tokenizer(std::string&& str, const std::vector<std::string>& delimiters) = delete;
+
+    static Tokenizer whitespaceTokenizer(const std::string& str) { return Tokenizer(str); }
+
+    // Sets token to the next token. Returns false when there are no more tokens.
+    bool next(StringRef& token);
+
+    // Size in bytes of the whitespace character at str, 0 if there is none.
+    static size_t whitespaceSize(const char *str, size_t size);
+};
 
 class StringUtils
 {
@@ -18,15 +70,24 @@ class StringUtils
     
     static std::vector<std::string> escapeStrings(const std::vector<std::string> &); 
 
+    // Splits on any of the delimiters (the first one listed wins at a position), like std::sregex_token_iterator
+    // with -1 over their alternation: empty tokens between adjacent delimiters are kept, a trailing empty token is
+    // not, and a string without delimiters is a single token.
     static std::vector<std::string> split(const std::string &, const std::vector<std::string> &);
 
     static std::vector<std::string> split(const std::string &, const std::string &);
     
     static std::vector<std::string> split(const std::string &);
 
+    // Splits on runs of ASCII and UTF-8 encoded Unicode whitespace. Gives no empty tokens.
+    static std::vector<std::string> splitWhitespace(const std::string &);
+
     static std::string join(const std::vector<std::string> &, const std::string &);
 
     static std::string toLower(const std::string& str);
+
+    // Removes wiki templates: same result as std::regex_replace(str, std::regex("\\{\\{[^\\}]+\\}\\}"), "").
+    static std::string stripTemplates(const std::string& str);
 };
 
 
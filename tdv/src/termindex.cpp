@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <stdexcept>
+#include "termindex.h"
+
+const uint64_t TERM_INDEX_MIN_SLOTS = 1024;
+
+// FNV-1a, followed by the SplitMix64 finalizer to spread it over the upper bits too.
+uint64_t TermIndex::hash(StringRef term)
+{
+    uint64_t h = 0xcbf29ce484222325ul;
+
+    for (size_t i = 0; i < term.size; i++)
+        h = (h ^ (unsigned char)term.data[i]) * 0x100000001b3ul;
+
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ul;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebul;
+
+    return h ^ (h >> 31);
+}
+
+bool TermIndex::matches(uint64_t slot, uint64_t hashValue, StringRef term) const
+{
+    // Most mismatches are rejected by the stored hash bits, without touching the arena.
+    return (slot >> 32) == (hashValue >> 32) && this->term((slot & 0xffffffffu) - 1) == term;
+}
+
+void TermIndex::grow()
+{
+    vector<uint64_t> oldSlots(std::max<uint64_t>(TERM_INDEX_MIN_SLOTS, slots.size() * 2), 0);
+    oldSlots.swap(slots);
+    mask = slots.size() - 1;
+
+    for (uint64_t slot : oldSlots)
+    {
+        if (slot == 0)
+            continue;
+
+        uint64_t pos = hash(term((slot & 0xffffffffu) - 1)) & mask;
+
+        while (slots[pos] != 0)
+            pos = (pos + 1) & mask;
+
+        slots[pos] = slot;
+    }
+}
+
+void TermIndex::reserve(ulong numTerms, ulong numBytes)
+{
+    arena.reserve(numBytes);
+    offsets.reserve(numTerms + 1);
+
+    while (slots.size() < numTerms * 2)
+        grow();
+}
+
+ulong TermIndex::insert(StringRef term)
+{
+    if ((size() + 1) * 2 > slots.size())
+        grow();
+
+    uint64_t hashValue = hash(term);
+    uint64_t pos = hashValue & mask;
+
+    while (slots[pos] != 0)
+    {
+        if (matches(slots[pos], hashValue, term))
+            return (slots[pos] & 0xffffffffu) - 1;
+
+        pos = (pos + 1) & mask;
+    }
+
+    ulong index = size();
+
+    if (index >= 0xffffffffu)
+        throw std::length_error("TermIndex: too many terms");
+
+    arena.insert(arena.end(), term.data, term.data + term.size);
+    offsets.push_back(arena.size());
+    slots[pos] = (hashValue & 0xffffffff00000000ul) | (index + 1);
+
+    return index;
+}
+
+ulong TermIndex::find(StringRef term) const
+{
+    if (slots.empty())
+        return npos;
+
+    uint64_t hashValue = hash(term);
+    uint64_t pos = hashValue & mask;
+
+    while (slots[pos] != 0)
+    {
+        if (matches(slots[pos], hashValue, term))
+            return (slots[pos] & 0xffffffffu) - 1;
+
+        pos = (pos + 1) & mask;
+    }
+
+    return npos;
+}
+
+ulong TermIndex::at(StringRef term) const
+{
+    ulong index = find(term);
+
+    if (index == npos)
+        throw std::out_of_range("TermIndex: term not found: " + term.str());
+
+    return index;
+}
+
+void TermIndex::clear()
+{
+    vector<char>().swap(arena);
+    offsets.assign(1, 0);
+    vector<uint64_t>().swap(slots);
+    mask = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef TERMINDEX_H
+#define TERMINDEX_H
+#include <cstdint>
+#include "types.h"
+#include "stringutils.h"
+
+// Term dictionary: term bytes are interned in one arena, and looked up through an open-addressing hash table
+// (linear probing, at most half full). Terms get consecutive indices in insertion order. Lookups take string
+// slices and never allocate.
+class TermIndex
+{
+    vector<char> arena;
+    // Arena offset of each term, plus the end of the last one.
+    vector<uint64_t> offsets;
+    // Hash table slots: upper 32 bits of the term hash, and the term index + 1 (0 marks an empty slot).
+    vector<uint64_t> slots;
+    uint64_t mask = 0;
+
+    static uint64_t hash(StringRef term);
+    bool matches(uint64_t slot, uint64_t hashValue, StringRef term) const;
+    void grow();
+
+    public:
+    static const ulong npos = ~0ul;
+
+    TermIndex() : offsets(1, 0) {}
+
+    void reserve(ulong numTerms, ulong numBytes);
+    // Index of the term, added if not present.
+    ulong insert(StringRef term);
+    // Index of the term, or npos if not present.
+    ulong find(StringRef term) const;
+    // Index of the term. Throws std::out_of_range if not present.
+    ulong at(StringRef term) const;
+    ulong count(StringRef term) const { return find(term) != npos; }
+    ulong size() const { return offsets.size() - 1; }
+    StringRef term(ulong index) const { return StringRef(arena.data() + offsets[index], offsets[index + 1] - offsets[index]); }
+    void clear();
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(uint numThreads)
+{
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    // The calling thread takes part in its own jobs, so one thread less is spawned.
+    for (uint i = 0; i + 1 < numThreads; i++)
+        threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wakeup.notify_all();
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+// Must be called with the mutex held.
+bool ThreadPool::claimTask(Job *job, ulong& task)
+{
+    if (job->nextTask >= job->numTasks)
+    {
+        auto jobIt = std::find(jobs.begin(), jobs.end(), job);
+        if (jobIt != jobs.end())
+            jobs.erase(jobIt);
+
+        return false;
+    }
+
+    task = job->nextTask++;
+    return true;
+}
+
+void ThreadPool::runTask(Job *job, ulong task, uint worker)
+{
+    std::exception_ptr error;
+
+    try
+    {
+        (*job->fn)(task, worker);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (error && !job->error)
+    {
+        // The tasks not claimed yet are skipped, and counted as done.
+        job->error = error;
+        job->doneTasks += job->numTasks - job->nextTask;
+        job->nextTask = job->numTasks;
+    }
+
+    job->doneTasks++;
+
+    if (job->doneTasks == job->numTasks)
+        job->finished.notify_all();
+}
+
+void ThreadPool::workerLoop(uint worker)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        wakeup.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+        if (stopping)
+            return;
+
+        Job *job = jobs.front();
+        ulong task;
+
+        if (!claimTask(job, task))
+            continue;
+
+        lock.unlock();
+        runTask(job, task, worker);
+        lock.lock();
+    }
+}
+
+void ThreadPool::parallelFor(ulong numTasks, const std::function<void(ulong task, uint worker)>& fn)
+{
+    Job job;
+    job.fn = &fn;
+    job.numTasks = numTasks;
+    job.nextTask = 0;
+    job.doneTasks = 0;
+
+    if (numTasks == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(&job);
+    }
+
+    wakeup.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ulong task;
+
+    while (claimTask(&job, task))
+    {
+        lock.unlock();
+        runTask(&job, task, threads.size());
+        lock.lock();
+    }
+
+    job.finished.wait(lock, [&job] { return job.doneTasks == job.numTasks; });
+
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
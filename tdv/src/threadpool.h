@@ -0,0 +1,52 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <exception>
+#include "types.h"
+
+// Persistent pool of worker threads running indexed tasks.
+// Workers are numbered 0..size()-2; the thread calling parallelFor also runs tasks of its own job, as worker size()-1,
+// so per-worker buffers of a job must have size() slots. Several threads may call parallelFor at the same time, but
+// each of them runs as worker size()-1: a per-worker buffer is only race free if it belongs to one parallelFor call
+// (or to calls that never overlap).
+class ThreadPool
+{
+    struct Job
+    {
+        const std::function<void(ulong, uint)> *fn;
+        ulong numTasks;
+        ulong nextTask;
+        ulong doneTasks;
+        // First exception thrown by a task: the remaining tasks are skipped.
+        std::exception_ptr error;
+        std::condition_variable finished;
+    };
+
+    vector<std::thread> threads;
+    std::deque<Job*> jobs;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+
+    bool claimTask(Job *job, ulong& task);
+    // Runs the task and counts it as done, recording its exception if it throws.
+    void runTask(Job *job, ulong task, uint worker);
+    void workerLoop(uint worker);
+
+    public:
+    // numThreads = 0 uses one worker per hardware thread.
+    explicit ThreadPool(uint numThreads);
+    ~ThreadPool();
+
+    uint size() const { return threads.size() + 1; }
+
+    // Runs fn(task, worker) for every task in [0, numTasks) and waits for all of them to finish.
+    // If a task throws, the tasks not started yet are skipped, and the first exception is rethrown once the others end.
+    void parallelFor(ulong numTasks, const std::function<void(ulong task, uint worker)>& fn);
+};
+
+#endif
@@ -1,12 +1,9 @@
 #include "vectorize.h"
 
-std::regex MARKUP_RGX("\\{\\{[^\\}]+\\}\\}");
 std::regex MARKUP_WIKI_RGX("(\\{\\{|\\[\\[)(w\\||:)?([^\\}]+)(\\|[^\\}]+)?(\\}\\}|\\]\\])");
 std::regex MARKUP_LABEL_RGX("(\\{\\{)(l|lb|label)\\|[a-z][a-z]\\|([^\\}\\|]+)(\\|[^\\}]+)?\\}\\})");
 std::regex MARKUP_FREE_RGX("('')|(''')|(\\[\\[)|(\\]\\])|(\\&[a-z]+;)");
 std::regex EXAMPLE_RGX("'''([^''']+)'''");
-vector<string> DECOMP_SINGLE_FIELDS({FLD_ETYM_PREFIX, FLD_ETYM_SUFFIX, FLD_ETYM_STEM});
-vector<string> DECOMP_MULTI_FIELDS({FLD_ETYM_CONFIX, FLD_ETYM_AFFIX});
 
 vector<ReprOffsetBase> REPR_OFFSET_BASES({
             ReprOffsetBase::weak,
@@ -28,32 +25,97 @@ vector<string> REPR_OFFSET_BASE_NAMES({"WEAK", "STRONG", "CONTEXT", "SYNONYM", "
                                         "ETYM_LINK", "PREFIX", "SUFFIX", "CONFIX", "AFFIX", "STEM", "TRANSLATION"});
 
 float TRANSL_MAX_INTERSECT_THRESH = 0.5;
+// Hypernym links followed from each meaning description.
+const int HYPERNYM_CHAIN_DEPTH = 3;
+// Terms (or cached meanings) per parallel task during vector generation.
+ulong PRELOAD_CHUNK_SIZE = 256;
+// Minimum number of candidate meanings per shard of a similar search.
+ulong SIMILAR_MIN_SHARD_SIZE = 4096;
 float SIM_EXPR_FIXED_GUESS = 0.6;
 float SIM_SYNWEIGHT_MULTIPLIER = 3;
 
 
+// String value of a DB field, referenced in place instead of converted to a new string.
+static inline const string& jsonString(const json& value)
+{
+    return value.get_ref<const string&>();
+}
+
 bool distComparator(const std::pair<ulong, float>& a, const std::pair<ulong, float>& b)
 {
     return (a.second < b.second);
 }
 
+bool simRankComparator(const std::pair<ulong, float>& a, const std::pair<ulong, float>& b)
+{
+    return (a.second > b.second || (a.second == b.second && a.first < b.first));
+}
+
+bool dissimRankComparator(const std::pair<ulong, float>& a, const std::pair<ulong, float>& b)
+{
+    return (a.second < b.second || (a.second == b.second && a.first < b.first));
+}
+
+TopK::TopK(uint size, bool reversed)
+{
+    this->size = size;
+    this->rankComparator = reversed ? dissimRankComparator : simRankComparator;
+    heap.reserve(size);
+}
+
+void TopK::push(ulong id, float score)
+{
+    std::pair<ulong, float> pair(id, score);
+
+    if (heap.size() < size)
+    {
+        heap.push_back(pair);
+        std::push_heap(heap.begin(), heap.end(), rankComparator);
+    }
+    else if (size > 0 && rankComparator(pair, heap.front()))
+    {
+        std::pop_heap(heap.begin(), heap.end(), rankComparator);
+        heap.back() = pair;
+        std::push_heap(heap.begin(), heap.end(), rankComparator);
+    }
+}
+
+void TopK::merge(const TopK& other)
+{
+    for (const std::pair<ulong, float>& pair : other.heap)
+        push(pair.first, pair.second);
+}
+
+vector<std::pair<ulong, float>> TopK::results()
+{
+    vector<std::pair<ulong, float>> sorted;
+
+    std::sort_heap(heap.begin(), heap.end(), rankComparator);
+    sorted.swap(heap);
+
+    return sorted;
+}
+
 
 Meaning::Meaning(const string& term)
 {
     this->term = term;
     this->repr = MeaningExtractor::getVector(term);
+    this->norm = this->repr.norm();
     this->pos = "";
 }
 
 Meaning::Meaning(SparseArray vec)
 {
     this->repr = vec;
+    this->norm = this->repr.norm();
 }
 
 Meaning::Meaning(const string& term, const vector<string>& context)
 {
     this->term = term;
     this->repr = MeaningExtractor::getVector(term, context);
+    this->norm = this->repr.norm();
     this->pos = "";
     this->context = context;
 }
@@ -62,6 +124,7 @@ Meaning::Meaning(const string& term, const string& pos)
 {
     this->term = term;
     this->repr = MeaningExtractor::getVector(term, pos);
+    this->norm = this->repr.norm();
     this->pos = pos;
 }
 
@@ -69,6 +132,7 @@ Meaning::Meaning(const string& term, const string& pos, const vector<string>& co
 {
     this->term = term;
     this->repr = MeaningExtractor::getVector(term, pos, context);
+    this->norm = this->repr.norm();
     this->pos = pos;
     this->context = context;
 }
@@ -77,48 +141,60 @@ Meaning::Meaning(const string& term, const string& pos, uint index)
 {
     this->term = term;
     this->repr = MeaningExtractor::getVector(term, pos, index);
+    this->norm = this->repr.norm();
     this->pos = pos;
     this->index = index;
 }
 
-SparseArray Meaning::getVector()
+SparseArray Meaning::getVector() const
 {
     return repr;
 }
 
-vector<std::pair<ulong, float>> Meaning::similar(uint size, bool reversed)
+void Meaning::updateNorm()
+{
+    norm = repr.norm();
+}
+
+vector<std::pair<ulong, float>> Meaning::similar(uint size, bool reversed) const
 {
     return MeaningExtractor::similarRepr(repr, size, reversed, pos);
 }
 
 WiktDB *MeaningExtractor::wiktdb;
 umap<ulong, Meaning> MeaningExtractor::reprCache;
+SimilarityIndex MeaningExtractor::similarityIndex;
+LshIndex MeaningExtractor::lshIndex;
+HypernymMemo MeaningExtractor::hypernymMemo;
 Config MeaningExtractor::config;
 std::map<ulong, ulong> MeaningExtractor::effectiveDims;
 set<string> MeaningExtractor::stopPOSList({"prefix", "suffix", "infix", "affix", "interfix", "article", "pronoun", 
                                            "adverb", "proverb", "letter", "conjunction", "determiner", "preposition", 
                                            "postposition", "numeral", "number", "particle", "interjection"});
-bool MeaningExtractor::graphFill = false;
-uint MeaningExtractor::linkSearchDepth = 1;
 bool MeaningExtractor::vectorsLoaded = false;
+vector<ulong> MeaningExtractor::languageIds;
+ulong MeaningExtractor::nounTag = WiktDB::npos;
 
 void MeaningExtractor::setDB(WiktDB *wiktdb)
 {
     MeaningExtractor::wiktdb = wiktdb;
+    languageIds.clear();
+
+    for (const string& lang : config.languages)
+        languageIds.push_back(wiktdb->langId(lang));
+
+    nounTag = wiktdb->posTag("noun");
 }
 
-bool MeaningExtractor::findTerm(const string& term, json& termRef)
+EntryRef MeaningExtractor::findTerm(const string& term)
 {
-    try
-    {
-        termRef = (*wiktdb)[term];
-        return true;
-    }
-    catch (std::out_of_range e)
+    if (!wiktdb->exists(term))
     {
         std::cerr << "Term not found: " << term << std::endl;
-        return false;
+        return EntryRef();
     }
+
+    return wiktdb->entry(term);
 }
 
 vector<string> MeaningExtractor::findContext(const json& meaningRef)
@@ -129,7 +205,7 @@ vector<string> MeaningExtractor::findContext(const json& meaningRef)
     {
         for (const json& attrRef: meaningRef[FLD_ATTRS])
         {
-            const string& attrName = attrRef[0];
+            const string& attrName = jsonString(attrRef[0]);
             if (attrName == "context" || attrName == "label" || attrName == "lb")
             {
                vector<string> ctxWords = StringUtils::split(attrRef[1], "|");
@@ -145,248 +221,197 @@ vector<string> MeaningExtractor::findContext(const json& meaningRef)
     return context;
 }
 
-void MeaningExtractor::findHypernymChain(vector<string>& hypernyms, const json& meaningRef, int depth, const uint fullDepth)
+bool HypernymMemo::find(ulong key, vector<ulong>& chain)
 {
-    if (depth >= 0)
+    Shard& shard = shards[key % NUM_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto chainIt = shard.chains.find(key);
+
+    if (chainIt == shard.chains.end())
     {
-        const string& descr = meaningRef[FLD_MEANING_DESCR];
-        string clnDescr = std::regex_replace(descr, MARKUP_RGX, "");
-        vector<string> meaningDescr = StringUtils::split(clnDescr);
+        misses++;
+        return false;
+    }
+
+    hits++;
+    chain.insert(chain.end(), chainIt->second.begin(), chainIt->second.end());
+
+    return true;
+}
+
+void HypernymMemo::insert(ulong key, vector<ulong>::const_iterator begin, vector<ulong>::const_iterator end)
+{
+    Shard& shard = shards[key % NUM_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    shard.chains.emplace(key, vector<ulong>(begin, end));
+}
 
-        for (const string& word : meaningDescr)
+void MeaningExtractor::findHypernymChain(vector<ulong>& hypernyms, const TermEntry& term, const MeaningEntry& meaning, int depth, const uint fullDepth)
+{
+    if (depth >= 0)
+    {
+        for (uint32_t wordIdx : term.span(meaning.hypernymWords))
         {
-            if (wiktdb->exists(word))
+            // The chain from a head noun on only depends on the word and the remaining depth.
+            // Words that are not head nouns are memoized as empty chains.
+            ulong memoKey = wordIdx * (HYPERNYM_CHAIN_DEPTH + 1) + depth;
+            size_t chainStart = hypernyms.size();
+
+            if (hypernymMemo.find(memoKey, hypernyms))
             {
-                const json& headTermRef = (*wiktdb)[word];
-                const json& headTermLangRef = headTermRef[FLD_LANGS].begin().value();
-                const string& headTermPrimePOS = headTermLangRef[FLD_POS_ORDER][0];
+                if (hypernyms.size() > chainStart)
+                    break;
 
-                if (headTermPrimePOS == "noun" and headTermLangRef[FLD_MEANINGS].count(headTermPrimePOS))
-                {
-                    hypernyms.push_back(word);
-                    const json& headTermPrimeMeaningRefs = headTermLangRef[FLD_MEANINGS][headTermPrimePOS];
-                    const json& headTermPrimeMeaningRef = headTermPrimeMeaningRefs.begin().value();
-                    MeaningExtractor::findHypernymChain(hypernyms, headTermPrimeMeaningRef, depth - 1, fullDepth);
+                continue;
+            }
 
-                    break;
-                }
+            TermEntryRef headTerm = wiktdb->termEntry(wordIdx);
+
+            if (headTerm->headNoun != TERM_ENTRY_NONE)
+            {
+                hypernyms.push_back(wordIdx);
+                MeaningExtractor::findHypernymChain(hypernyms, *headTerm, headTerm->meanings[headTerm->headNoun], depth - 1, fullDepth);
+
+                hypernymMemo.insert(memoKey, hypernyms.begin() + chainStart, hypernyms.end());
+                break;
             }
+
+            hypernymMemo.insert(memoKey, hypernyms.end(), hypernyms.end());
         }
     } 
 }
 
-void MeaningExtractor::fillWeak(SparseArray& vec, const json& meaningRef)
+void MeaningExtractor::fillWeak(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning)
 {
-    vector<string> meaningWords = StringUtils::split(meaningRef[FLD_MEANING_DESCR]);
     float linkValue = config.linkWeights.link_weak;
     ReprOffsetBase linkType = ReprOffsetBase::weak;
 
-    if (meaningWords.size() == 1)
+    if (meaning.singleWord)
     {
         linkValue = config.linkWeights.link_strong;
         linkType = ReprOffsetBase::strong;
     }
 
-    for(const string& word : meaningWords)
-    {
-        if (wiktdb->exists(word))
-        {
-            vec[wiktdb->linkIndex(word, linkType)] = linkValue;
-        }
-        else 
-        {
-            string lcword = StringUtils::toLower(word);
-
-            if (wiktdb->exists(lcword))
-                vec[wiktdb->linkIndex(lcword, linkType)] = linkValue;
-        }
-    }
+    for (uint32_t wordIdx : term.span(meaning.weakLinks))
+        vec[wiktdb->linkIndex(wordIdx, linkType)] = linkValue;
 }
 
-void MeaningExtractor::fillContext(SparseArray& vec, const vector<string>& context)
+void MeaningExtractor::fillContext(SparseArray& vec, const TermEntry& term, IdRange context)
 {
-    for (const string& ctxWord : context)
-    {
-        if (wiktdb->exists(ctxWord))
-        {
-            vec[wiktdb->linkIndex(ctxWord, ReprOffsetBase::context)] = config.linkWeights.link_context;
-        }
-    }
+    for (uint32_t ctxIdx : term.span(context))
+        vec[wiktdb->linkIndex(ctxIdx, ReprOffsetBase::context)] = config.linkWeights.link_context;
 }
 
-void MeaningExtractor::fillStrong(SparseArray& vec, const json& meaningRef)
+void MeaningExtractor::fillStrong(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning)
 {
-    if (meaningRef.count(FLD_LINKS))
-    {
-        for (const string& link: meaningRef[FLD_LINKS])
-        {
-            if (wiktdb->exists(link))
-            {
-                vec[wiktdb->linkIndex(link, ReprOffsetBase::strong)] = config.linkWeights.link_strong;
-            }
-        }
-    }
+    for (uint32_t linkIdx : term.span(meaning.links))
+        vec[wiktdb->linkIndex(linkIdx, ReprOffsetBase::strong)] = config.linkWeights.link_strong;
 }
 
-void MeaningExtractor::fillSynonym(SparseArray& vec, const string& pos, const json& meaningRef, const json& termRef, const vector<string>& context)
+void MeaningExtractor::fillSynonym(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning, IdRange context)
 {
-    if (termRef.count(FLD_REDIRECT) && wiktdb->exists(termRef[FLD_REDIRECT][0]))
+    if (term.redirect != TERM_ENTRY_NONE)
     {
-        vec[wiktdb->linkIndex(termRef[FLD_REDIRECT][0], ReprOffsetBase::synonym)] = config.linkWeights.link_syn;
+        vec[wiktdb->linkIndex(term.redirect, ReprOffsetBase::synonym)] = config.linkWeights.link_syn;
         return;
     }
 
-    if (meaningRef.count(FLD_LINKS) && meaningRef[FLD_LINKS].size() == 1)
-    {
-        const string& link = meaningRef[FLD_LINKS][0];
-        if (wiktdb->exists(link))
-        {
-            const string& meaningDescr = meaningRef[FLD_MEANING_DESCR];
-            if (std::regex_match(meaningDescr, std::regex("^not? .*")))
-                vec[wiktdb->linkIndex(link, ReprOffsetBase::synonym)] = -config.linkWeights.link_syn;
-            else if (std::regex_match(meaningDescr, std::regex("^(a|an)? " + link)))
-                vec[wiktdb->linkIndex(link, ReprOffsetBase::synonym)] = config.linkWeights.link_syn;
-        }
-    }
+    if (meaning.linkSynSign)
+        vec[wiktdb->linkIndex(term.ids[meaning.links.begin], ReprOffsetBase::synonym)] = meaning.linkSynSign * config.linkWeights.link_syn;
     
-    umap<string, float> synTypes ({{FLD_SYNONYMS, config.linkWeights.link_syn}, {FLD_ANTONYMS, -config.linkWeights.link_syn}});
+    // Antonyms first, so that a term listed as both keeps the synonym weight.
+    const std::pair<bool, float> synTypes[2] = {{true, -config.linkWeights.link_syn}, {false, config.linkWeights.link_syn}};
 
-    for (auto it = synTypes.begin(); it != synTypes.end(); ++it)
+    for (const std::pair<bool, float>& synType : synTypes)
     {
-        for (const string& lang : MeaningExtractor::config.languages)
+        bool antonyms = synType.first;
+
+        for (ulong langId : MeaningExtractor::languageIds)
         {
-            if (!termRef[FLD_LANGS].count(lang))
+            const LangEntry *langEntry = term.lang(langId);
+
+            if (!langEntry)
                 continue;
 
-            if (termRef[FLD_LANGS][lang].count(it->first) and termRef[FLD_LANGS][lang][it->first].count(pos))
+            const SynonymListEntry *synList = term.synonymList(*langEntry, meaning.posTag, antonyms);
+
+            if (!synList)
+                continue;
+
+            for (uint32_t i = synList->first; i < synList->first + synList->num; i++)
             {
-                for (const json& synRef : termRef[FLD_LANGS][lang][it->first][pos])
-                {
-                    if (synRef.count(FLD_ATTRS))
-                    {
-                        for (const json& attrRef : synRef[FLD_ATTRS])
-                        {
-                            const string& attrName = attrRef[0];
-                            if (attrName == "sense")
-                            {
-                                vector<string> senseWords = StringUtils::split(attrRef[1], ",");
-
-                                for (const string& senseWord : senseWords)
-                                {
-                                    if (wiktdb->exists(senseWord))
-                                    {
-                                        if (checkContextSyn(senseWord, meaningRef, context))
-                                        {
-                                            vec[wiktdb->linkIndex(senseWord, ReprOffsetBase::synonym)] = it->second;
-                                        }
-                                    }
-                                }
-                            }
-                            else if (attrName == "l" || attrName == "label")
-                            {
-                                const string& synTerm = attrRef[1];
-                                if (wiktdb->exists(synTerm))
-                                    vec[wiktdb->linkIndex(synTerm, ReprOffsetBase::synonym)] = it->second;
-                            }
-                        }
-                    }
+                const SynonymEntry& syn = term.synonyms[i];
 
-                    else
-                    { 
-                        if (wiktdb->exists(synRef[FLD_MEANING_DESCR]))
-                        {
-                            vec[wiktdb->linkIndex(synRef[FLD_MEANING_DESCR], ReprOffsetBase::synonym)] = it->second;
-                        }
-                    }
-                }
+                if (!syn.senseCheck || checkContextSyn(syn.term, term, meaning, context))
+                    vec[wiktdb->linkIndex(syn.term, ReprOffsetBase::synonym)] = synType.second;
             }
         }
     }
 }
 
-void MeaningExtractor::fillHypernymChain(SparseArray& vec, const json& meaningRef)
+void MeaningExtractor::fillHypernymChain(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning)
 {
-    vector<string> hypernyms;
-    MeaningExtractor::findHypernymChain(hypernyms, meaningRef, 3, 3);
+    vector<ulong> hypernyms;
+    MeaningExtractor::findHypernymChain(hypernyms, term, meaning, HYPERNYM_CHAIN_DEPTH, HYPERNYM_CHAIN_DEPTH);
 
-    for (const string& hyp : hypernyms)
-        vec[wiktdb->linkIndex(hyp, ReprOffsetBase::hypernym)] = config.linkWeights.link_hyp;
+    for (ulong hypIdx : hypernyms)
+        vec[wiktdb->linkIndex(hypIdx, ReprOffsetBase::hypernym)] = config.linkWeights.link_hyp;
 }
 
-void MeaningExtractor::fillGraph(SparseArray& vec, const string& pos, const json& meaningRef, int depth, const uint fullDepth)
+void MeaningExtractor::fillGraph(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning, int depth, const uint fullDepth)
 {
     SparseArray graphVec;
     if (depth >= 0)
     {
-        vector<string> links;
-        
-        if (meaningRef.count(FLD_LINKS))
-        {
-            for (const string& link: meaningRef[FLD_LINKS])
-            {
-                links.push_back(link);
-            }
-        }
-        
-        if (meaningRef.count(FLD_ATTRS))
-        {
-            for (const json& attrRef : meaningRef[FLD_ATTRS])
-            {
-                const string& attrName = attrRef[0];
-                if (attrName == "inflec")
-                {
-                    const string& stem = attrRef[2];
-                    links.push_back(stem);
-                }
-            }
-        }
-
+        IdSpan linkSpan = term.span(meaning.links);
+        IdSpan stemSpan = term.span(meaning.inflecStems);
+        vector<uint32_t> links(linkSpan.begin(), linkSpan.end());
+        links.insert(links.end(), stemSpan.begin(), stemSpan.end());
 
-        for (const string& link: links)
+        for (uint32_t link : links)
         {
-            if (wiktdb->exists(link))
+            TermEntryRef linkTerm = wiktdb->termEntry(link);
+
+            for (ulong langId : MeaningExtractor::languageIds)
             {
-                const json& linkTermRef = (*wiktdb)[link];
-                
-                for (const string& lang : MeaningExtractor::config.languages)
-                {
-                    if (!linkTermRef[FLD_LANGS].count(lang))
-                        continue;
+                const LangEntry *linkLang = linkTerm->lang(langId);
 
-                    const json& linkDocLangRef = linkTermRef[FLD_LANGS][lang];
-                    const json& linkDocMeaningRefs = linkDocLangRef[FLD_MEANINGS];
-                    
-                    if (linkDocMeaningRefs.count(pos))
-                    {
-                        const json& linkMeaningRefs = linkDocMeaningRefs[pos];
-    
-                        for (const json& linkMeaningRef : linkMeaningRefs)
-                        {
-                            MeaningExtractor::fillGraph(vec, pos, linkMeaningRef, depth - 1, fullDepth);
-                        }
+                if (!linkLang)
+                    continue;
 
-                    }
+                const PosEntry *linkPos = linkTerm->posList(*linkLang, meaning.posTag);
 
-                    if (pos != "noun" && linkDocMeaningRefs.count("noun"))
+                if (linkPos)
+                {
+                    for (uint32_t i = linkPos->firstMeaning; i < linkPos->firstMeaning + linkPos->numMeanings; i++)
                     {
-                        const json& linkMeaningRefs = linkDocMeaningRefs["noun"];
-    
-                        for (const json& linkMeaningRef : linkMeaningRefs)
-                        {
-                            MeaningExtractor::fillGraph(vec, "noun", linkMeaningRef, depth - 1, fullDepth);
-                        }
+                        MeaningExtractor::fillGraph(vec, *linkTerm, linkTerm->meanings[i], depth - 1, fullDepth);
                     }
+                }
+
+                const PosEntry *linkNounPos = linkTerm->posList(*linkLang, nounTag);
 
-                    for (auto posIt = linkDocMeaningRefs.begin(); posIt != linkDocMeaningRefs.end(); ++posIt)
+                if (meaning.posTag != nounTag && linkNounPos)
+                {
+                    for (uint32_t i = linkNounPos->firstMeaning; i < linkNounPos->firstMeaning + linkNounPos->numMeanings; i++)
                     {
-                        string synPOS = string(posIt.key());
-                        SparseArray synVec;
-                        fillSynonym(synVec, synPOS, linkDocMeaningRefs[synPOS][0], linkTermRef, vector<string>());
-                        graphVec += synVec / ((fullDepth - depth + 1) * 2);
+                        MeaningExtractor::fillGraph(vec, *linkTerm, linkTerm->meanings[i], depth - 1, fullDepth);
                     }
-                    
-                    graphVec[wiktdb->linkIndex(link, ReprOffsetBase::weak)] = config.linkWeights.link_strong / ((fullDepth - depth + 1) * 2);
                 }
+
+                for (uint32_t i = linkLang->firstPos; i < linkLang->firstPos + linkLang->numPos; i++)
+                {
+                    const PosEntry& synPos = linkTerm->posLists[i];
+                    SparseArray synVec;
+
+                    if (synPos.numMeanings)
+                        fillSynonym(synVec, *linkTerm, linkTerm->meanings[synPos.firstMeaning], IdRange());
+
+                    graphVec += synVec / ((fullDepth - depth + 1) * 2);
+                }
+                
+                graphVec[wiktdb->linkIndex(link, ReprOffsetBase::weak)] = config.linkWeights.link_strong / ((fullDepth - depth + 1) * 2);
             }
         }
 
@@ -394,206 +419,132 @@ void MeaningExtractor::fillGraph(SparseArray& vec, const string& pos, const json
     }
 }
 
-void MeaningExtractor::fillInflec(SparseArray& vec, const json& meaningRef)
+void MeaningExtractor::fillInflec(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning)
 {
-    if (meaningRef.count(FLD_ATTRS))
+    for (uint32_t stemIdx : term.span(meaning.inflecStems))
     {
-        for (const json& attrRef : meaningRef[FLD_ATTRS])
-        {
-            const string& attrName = attrRef[0];
-            if (attrName == "inflec")
-            {
-                const string& stem = attrRef[2];
-                {
-                    if (wiktdb->exists(stem))
-                    {
-                        vec[wiktdb->linkIndex(stem, ReprOffsetBase::stem)] = config.linkWeights.link_pos;
-                        vec[wiktdb->linkIndex(stem, ReprOffsetBase::strong)] = config.linkWeights.link_strong;
-                    }
-                }
-            }
-        }
+        vec[wiktdb->linkIndex(stemIdx, ReprOffsetBase::stem)] = config.linkWeights.link_pos;
+        vec[wiktdb->linkIndex(stemIdx, ReprOffsetBase::strong)] = config.linkWeights.link_strong;
     }
 }
 
-void MeaningExtractor::fillMorphoInfo(SparseArray& vec, const string& pos, const json& termRef)
+void MeaningExtractor::fillMorphoInfo(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning)
 {
-    vec[wiktdb->posIndex(pos)] = config.linkWeights.link_pos;
-    vec[wiktdb->linkIndex(termRef[FLD_TITLE], ReprOffsetBase::homonym)] = config.linkWeights.link_hom;
+    vec[wiktdb->posTagIndex(meaning.posTag)] = config.linkWeights.link_pos;
+    vec[wiktdb->linkIndex(term.index, ReprOffsetBase::homonym)] = config.linkWeights.link_hom;
 
-    if (!termRef.count(FLD_LANGS))
-        return;
-
-    for (const json& termLangRef : termRef[FLD_LANGS])
+    for (uint i = 0; i < 6; i++)
     {
-        if (termLangRef.count(FLD_ETYMOLOGY))
-        {
-            if (termLangRef[FLD_ETYMOLOGY].count(FLD_LINKS))
-            {
-                for (const string& link : termLangRef[FLD_ETYMOLOGY][FLD_LINKS])
-                {
-                    if (wiktdb->exists(link))
-                        vec[wiktdb->etymLinkIndex(link)] = config.linkWeights.link_etym;
-                }
-            }
- 
-            for (const string& decompField : DECOMP_SINGLE_FIELDS)
-            {
-                if (termLangRef[FLD_ETYMOLOGY].count(decompField))
-                {
-                    const string& morpheme = termLangRef[FLD_ETYMOLOGY][decompField];
-                    if (wiktdb->exists(morpheme))
-                        vec[wiktdb->etymDecompIndex(morpheme, decompField)] = config.linkWeights.link_etym;
-                }
-            }
-            
-            for (const string& decompField : DECOMP_MULTI_FIELDS)
-            {
-                if (termLangRef[FLD_ETYMOLOGY].count(decompField))
-                {
-                    for (const string& morpheme : termLangRef[FLD_ETYMOLOGY][decompField])
-                    {
-                        if (wiktdb->exists(morpheme))
-                            vec[wiktdb->etymDecompIndex(morpheme, decompField)] = config.linkWeights.link_etym;
-                    }
-                }
-            }
-        }
+        ReprOffsetBase etymBase = (ReprOffsetBase)(ReprOffsetBase::etymLink + i);
+
+        for (uint32_t morphemeIdx : term.span(term.etymology[i]))
+            vec[wiktdb->linkIndex(morphemeIdx, etymBase)] = config.linkWeights.link_etym;
     }
 }
 
-void MeaningExtractor::fillTranslation(SparseArray& vec, const string& pos, const json& meaningRef, const json& termRef)
+void MeaningExtractor::fillTranslation(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning)
 {
-    vector<string> meaningWords = StringUtils::split(StringUtils::toLower(meaningRef[FLD_MEANING_DESCR]));
-    set<string> meaningWordSet = set<string>(meaningWords.begin(), meaningWords.end());
+    IdSpan meaningWords = term.span(meaning.descrWords);
     float intersect = 0.0;
     float maxIntersect = 0.0;
-    json *selTransl;
-
-    if (!termRef.count(FLD_LANGS))
-        return;
+    const TranslationEntry *selTransl = nullptr;
 
-    for (const json& termLangRef : termRef[FLD_LANGS])
+    for (const LangEntry& langEntry : term.langs)
     {
-        if (termLangRef.count(FLD_TRANSLATIONS) && termLangRef[FLD_TRANSLATIONS].count(pos))
+        const TranslationListEntry *translList = term.translationList(langEntry, meaning.posTag);
+
+        if (!translList)
+            continue;
+
+        if (translList->num == 1)
         {
-            if (termLangRef[FLD_TRANSLATIONS][pos].size() == 1)
-            {
-                selTransl = &(json&)termLangRef[FLD_TRANSLATIONS][pos][0][FLD_TRANSL];
-                maxIntersect = 1.0;
-            }
-            else
+            selTransl = &term.translations[translList->first];
+            maxIntersect = 1.0;
+        }
+        else
+        {
+            for (uint32_t i = translList->first; i < translList->first + translList->num; i++)
             {
-                for (const json& translMeaning: termLangRef[FLD_TRANSLATIONS][pos])
-                {
-                    vector<string> translMeaningWords = StringUtils::split(StringUtils::toLower(translMeaning[FLD_MEANING_DESCR]));
-                    set<string> translMeaningWordSet = set<string>(translMeaningWords.begin(), translMeaningWords.end());
-                    vector<string> wordIntersec;
+                // Description words are sorted entry-local IDs, so the intersection is a merge.
+                IdSpan translMeaningWords = term.span(term.translations[i].descrWords);
+                const uint32_t *meaningIt = meaningWords.begin();
+                const uint32_t *translIt = translMeaningWords.begin();
+                ulong numCommon = 0;
 
-                    std::set_intersection(meaningWordSet.begin(), meaningWordSet.end(),
-                                          translMeaningWordSet.begin(), translMeaningWordSet.end(),
-                                          std::back_inserter(wordIntersec));
-
-                    intersect = float(wordIntersec.size()) / meaningWordSet.size();
-                    if (intersect > maxIntersect)
+                while (meaningIt != meaningWords.end() && translIt != translMeaningWords.end())
+                {
+                    if (*meaningIt < *translIt)
+                        ++meaningIt;
+                    else if (*translIt < *meaningIt)
+                        ++translIt;
+                    else
                     {
-                        maxIntersect = intersect;
-                        selTransl = &(json&)translMeaning[FLD_TRANSL];
+                        numCommon++;
+                        ++meaningIt;
+                        ++translIt;
                     }
                 }
+
+                intersect = float(numCommon) / meaningWords.size();
+                if (intersect > maxIntersect)
+                {
+                    maxIntersect = intersect;
+                    selTransl = &term.translations[i];
+                }
             }
         }
     }
 
     if (maxIntersect > TRANSL_MAX_INTERSECT_THRESH)
     {
-        for (auto translTermIt = selTransl->begin(); translTermIt != selTransl->end(); ++translTermIt)
-        {
-            //const string& translTermLang = translTermIt.key();
-            json& translTermLst = translTermIt.value();
-
-            for (json& translTermRef : translTermLst)
-            {
-                const string& translTerm = translTermRef[0];
-
-                if (wiktdb->exists(translTerm))
-                    vec[wiktdb->linkIndex(translTerm, ReprOffsetBase::translation)] = config.linkWeights.link_transl;
-            }
-        }
+        for (uint32_t translIdx : term.span(selTransl->terms))
+            vec[wiktdb->linkIndex(translIdx, ReprOffsetBase::translation)] = config.linkWeights.link_transl;
     }
 }
 
-void MeaningExtractor::fillAll(SparseArray& vec, const string& pos, const json& meaningRef, const json& termRef, const vector<string>& context)
+void MeaningExtractor::fillAll(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning, const VectorOptions& options)
 {
-    fillWeak(vec, meaningRef);
-    fillContext(vec, context);
-    fillStrong(vec, meaningRef);
-    fillSynonym(vec, pos, meaningRef, termRef, context);
-    fillHypernymChain(vec, meaningRef);
-    fillInflec(vec, meaningRef);
-    fillMorphoInfo(vec, pos, termRef);
-    fillTranslation(vec, pos, meaningRef, termRef);
-
-    if (MeaningExtractor::graphFill)
-        fillGraph(vec, pos, meaningRef, MeaningExtractor::linkSearchDepth, MeaningExtractor::linkSearchDepth);
+    fillWeak(vec, term, meaning);
+    fillContext(vec, term, meaning.context);
+    fillStrong(vec, term, meaning);
+    fillSynonym(vec, term, meaning, meaning.context);
+    fillHypernymChain(vec, term, meaning);
+    fillInflec(vec, term, meaning);
+    fillMorphoInfo(vec, term, meaning);
+    fillTranslation(vec, term, meaning);
+
+    if (options.graphFill)
+        fillGraph(vec, term, meaning, options.linkSearchDepth, options.linkSearchDepth);
 }
 
-bool MeaningExtractor::checkContextSyn(const string& senseWord, const json& meaningRef, const vector<string>& context)
+bool MeaningExtractor::checkContextSyn(uint32_t senseWord, const TermEntry& term, const MeaningEntry& meaning, IdRange context)
 {
-    bool contextMatch = false;
-
-    if (meaningRef.count(FLD_LINKS))
+    if (meaning.hasLinks)
     {
-        for (const string& link: meaningRef[FLD_LINKS])
+        for (uint32_t linkIdx : term.span(meaning.links))
         {
-            if (wiktdb->exists(link) and link == senseWord)
-            {
-                contextMatch = true;
-            }
+            if (linkIdx == senseWord)
+                return true;
         }
+
+        return false;
     }
-    else
+
+    for (uint32_t ctxIdx : term.span(context))
     {
-        for (const string& ctxWord : context)
-        {
-            if (senseWord == ctxWord)
-            {
-                contextMatch = true;
-                break;
-            }
+        if (ctxIdx == senseWord)
+            return true;
 
-            if (wiktdb->exists(ctxWord))
-            {
-                const json& ctxRef = (*wiktdb)[ctxWord];
-                
-                if (ctxRef.count(FLD_SYNONYMS))
-                {
-                    for (const json& ctxSynRef : ctxRef[FLD_SYNONYMS])
-                    {
-                        if (ctxSynRef[FLD_MEANING_DESCR] == senseWord)
-                        {
-                            contextMatch = true;
-                            break;
-                        }
-                    }
-                }
-                
-                if (ctxRef.count(FLD_ABBREV))
-                {
-                    for (const string& abbr : ctxRef[FLD_ABBREV])
-                    {
-                        if (abbr == senseWord)
-                        {
-                            contextMatch = true;
-                            break;
-                        }
-                    }
-                }
-            }
+        TermEntryRef ctxTerm = wiktdb->termEntry(ctxIdx);
+
+        for (uint32_t ctxSynIdx : ctxTerm->span(ctxTerm->contextSynonyms))
+        {
+            if (ctxSynIdx == senseWord)
+                return true;
         }
     }
 
-    return contextMatch;
+    return false;
 }
 
 SparseArray MeaningExtractor::getVector(const string& term)
@@ -602,14 +553,21 @@ SparseArray MeaningExtractor::getVector(const string& term)
 }
 
 SparseArray MeaningExtractor::getVector(const string& term, const string& pos)
+{
+    return getVector(term, pos, VectorOptions());
+}
+
+SparseArray MeaningExtractor::getVector(const string& term, const string& pos, const VectorOptions& options)
 {
     SparseArray vec;
-    json termRef;
+    EntryRef termEntry = findTerm(term);
     uint vecNormDenominator = 0;
-    
-    if (!findTerm(term, termRef))
+
+    if (!termEntry)
         return vec;
 
+    const json& termRef = *termEntry;
+
     for (const string& lang : MeaningExtractor::config.languages)
     {
         if (!termRef[FLD_LANGS].count(lang))
@@ -626,7 +584,7 @@ SparseArray MeaningExtractor::getVector(const string& term, const string& pos)
        
         for (const json& meaningRef : meaningRefs)
         {
-            SparseArray meaningVec = MeaningExtractor::getVector(meaningRef, termRef, pos);
+            SparseArray meaningVec = MeaningExtractor::getMeaningVector(meaningRef[FLD_ID], options);
             vec += meaningVec;
         }
     }
@@ -639,11 +597,13 @@ SparseArray MeaningExtractor::getVector(const string& term, const string& pos)
 SparseArray MeaningExtractor::getVector(const string& term, const vector<string>& context)
 {
     SparseArray vec;
-    json termRef;
-    
-    if (!findTerm(term, termRef))
+    EntryRef termEntry = findTerm(term);
+
+    if (!termEntry)
         return vec;
 
+    const json& termRef = *termEntry;
+
     uint numSelected = 0;
 
     for (const string& lang : MeaningExtractor::config.languages)
@@ -678,10 +638,13 @@ SparseArray MeaningExtractor::getVector(const string& term, const vector<string>
 SparseArray MeaningExtractor::getVector(const string& term, const string& pos, const vector<string>& context)
 {
     SparseArray vec;
-    json termRef;
-     
-    if (!findTerm(term, termRef))
+    EntryRef termEntry = findTerm(term);
+
+    if (!termEntry)
         return vec;
+
+    const json& termRef = *termEntry;
+    TermEntryRef typedEntry = wiktdb->termEntry(wiktdb->index(term));
     
     for (const string& lang : MeaningExtractor::config.languages)
     {
@@ -701,24 +664,27 @@ SparseArray MeaningExtractor::getVector(const string& term, const string& pos, c
         {
             vector<string> meaningCtx = findContext(meaningRef);
             vector<string> meaningDescr = StringUtils::split(meaningRef[FLD_MEANING_DESCR]);
-            SparseArray meaningVec = MeaningExtractor::getVector(meaningRef, termRef, pos);
+            SparseArray meaningVec = MeaningExtractor::getMeaningVector(meaningRef[FLD_ID]);
             SparseArray extMeaningVec = meaningVec;
             float totalDistance = 0.0;
-            fillGraph(extMeaningVec, pos, meaningRef, config.linkSearchDepth, config.linkSearchDepth);
+            fillGraph(extMeaningVec, *typedEntry, typedEntry->meaning(meaningRef[FLD_ID]), config.linkSearchDepth, config.linkSearchDepth);
+            float extMeaningNorm = extMeaningVec.norm();
             
             for (const string& inputCtxWord : context)
             {
                 if (wiktdb->exists(inputCtxWord))
                 {
-                    vector<json> inputCtxMeanings;
+                    vector<ulong> inputCtxMeaningIds;
                     bool skip = false;
+                    EntryRef inputCtxTerm = wiktdb->entry(inputCtxWord);
+                    const json& inputCtxTermRef = *inputCtxTerm;
 
                     for (const string& lang : MeaningExtractor::config.languages)
                     {
-                        if (!(*wiktdb)[inputCtxWord][FLD_LANGS].count(lang))
+                        if (!inputCtxTermRef[FLD_LANGS].count(lang))
                             continue;
 
-                        const json& inputCtxTermLangRef = (*wiktdb)[inputCtxWord][FLD_LANGS][lang];
+                        const json& inputCtxTermLangRef = inputCtxTermRef[FLD_LANGS][lang];
 
                         for (const string& stopPOS : MeaningExtractor::stopPOSList)
                         {
@@ -741,7 +707,7 @@ SparseArray MeaningExtractor::getVector(const string& term, const string& pos, c
 
                             for (const json& inputCtxMeaningRef : inputCtxMeaningRefs)
                             {
-                                inputCtxMeanings.push_back(inputCtxMeaningRef);
+                                inputCtxMeaningIds.push_back(inputCtxMeaningRef[FLD_ID]);
                             }
                         }
                     }
@@ -760,8 +726,10 @@ SparseArray MeaningExtractor::getVector(const string& term, const string& pos, c
 
                     if (meaningRef.count(FLD_LINKS))
                     { 
-                        for (const string& link: meaningRef[FLD_LINKS])
+                        for (const json& linkRef : meaningRef[FLD_LINKS])
                         {
+                            const string& link = jsonString(linkRef);
+
                             if (link == inputCtxWord)
                             {
                                 skip = true;
@@ -783,21 +751,20 @@ SparseArray MeaningExtractor::getVector(const string& term, const string& pos, c
                     if (skip) continue;
                     
                     
-                    bool graphFill = MeaningExtractor::graphFill;
-                    MeaningExtractor::graphFill = true;
-
                     float maxRelatedness = 0.0;
-                    for (const json& inputCtxMeaningRef : inputCtxMeanings)
+                    for (ulong inputCtxMeaningId : inputCtxMeaningIds)
                     {
-                        SparseArray inputCtxVec = MeaningExtractor::reprCache[inputCtxMeaningRef[FLD_ID]].getVector();
-                        float relatedness = fabs(SparseArray::cosine(extMeaningVec, inputCtxVec));
+                        auto inputCtxIt = MeaningExtractor::reprCache.find(inputCtxMeaningId);
+
+                        if (inputCtxIt == MeaningExtractor::reprCache.end())
+                            continue;
+
+                        float relatedness = fabs(SparseArray::cosine(extMeaningVec, inputCtxIt->second.repr, extMeaningNorm, inputCtxIt->second.norm));
                         
                         if (relatedness > maxRelatedness)
                             maxRelatedness = relatedness;
                     }
 
-                    MeaningExtractor::graphFill = graphFill;
-
                     totalDistance += 1 - maxRelatedness;
                 }
             }
@@ -816,35 +783,49 @@ SparseArray MeaningExtractor::getVector(const string& term, const string& pos, c
 SparseArray MeaningExtractor::getVector(const string& term, const string& pos, uint index)
 {
     SparseArray vec;
-    json termRef;
-    
-    if (!findTerm(term, termRef))
+    EntryRef termEntry = findTerm(term);
+
+    if (!termEntry)
+        return vec;
+
+    const json& termRef = *termEntry;
+
+    // The entry is shared, so missing fields are checked for instead of being added on access.
+    if (!termRef[FLD_LANGS].count(MeaningExtractor::config.languages[0]))
         return vec;
 
     const json& docLangRef = termRef[FLD_LANGS][MeaningExtractor::config.languages[0]];
     const json& docMeaningRefs = docLangRef[FLD_MEANINGS];
 
-    if (!docMeaningRefs.count(pos))
+    if (!docMeaningRefs.count(pos) || index >= docMeaningRefs[pos].size())
         return vec;
 
     const json& meaningRefs = docMeaningRefs[pos];
     const json& meaningRef = meaningRefs[index];
-    vec = MeaningExtractor::getVector(meaningRef, termRef, pos);
+    vec = MeaningExtractor::getMeaningVector(meaningRef[FLD_ID]);
 
     return vec;
 }
 
-SparseArray MeaningExtractor::getVector(const json& meaningRef, const json& termRef, const string& pos)
+SparseArray MeaningExtractor::getMeaningVector(ulong meaningId)
+{
+    return getMeaningVector(meaningId, VectorOptions());
+}
+
+SparseArray MeaningExtractor::getMeaningVector(ulong meaningId, const VectorOptions& options)
 {
     SparseArray vec;
 
-    if (MeaningExtractor::reprCache.count(meaningRef[FLD_ID]) && !MeaningExtractor::graphFill)
+    if (!options.graphFill)
     {
-        return MeaningExtractor::reprCache[meaningRef[FLD_ID]].getVector();
+        auto cacheIt = MeaningExtractor::reprCache.find(meaningId);
+
+        if (cacheIt != MeaningExtractor::reprCache.end())
+            return cacheIt->second.repr;
     }
     
-    vector<string> context = findContext(meaningRef);
-    MeaningExtractor::fillAll(vec, pos, meaningRef, termRef, context);
+    TermEntryRef termEntry = wiktdb->termEntry(meaningId / (LANG_OFFSET_LIMIT * MEANING_OFFSET_LIMIT));
+    MeaningExtractor::fillAll(vec, *termEntry, termEntry->meaning(meaningId), options);
 
     return vec;
 }
@@ -852,47 +833,40 @@ SparseArray MeaningExtractor::getVector(const json& meaningRef, const json& term
 vector<ulong> MeaningExtractor::getMeaningRefIds(const string& term, const string& pos)
 {
     vector<ulong> meaningRefIds;
-    json termRef;
 
-    if (!findTerm(term, termRef))
+    if (!wiktdb->exists(term))
+    {
+        std::cerr << "Term not found: " << term << std::endl;
         return meaningRefIds;
+    }
 
+    ulong termIdx = wiktdb->index(term);
+
+    // Meaning IDs are taken from the DB records, so that the term entry does not have to be decoded.
     for (const string& lang : MeaningExtractor::config.languages)
     {
-        if (!termRef[FLD_LANGS].count(lang))
-            continue;
+        const LangRecord *langRec = wiktdb->langRecord(termIdx, lang);
 
-        const json& docLangRef = termRef[FLD_LANGS][lang];
-        const json& docMeaningRefs = docLangRef[FLD_MEANINGS];
+        if (!langRec)
+            continue;
 
         if (pos != "")
         {
-            if (!docMeaningRefs.count(pos))
-                break;
+            const PosRecord *posRec = wiktdb->posRecord(*langRec, pos);
 
-            const json& meaningRefs = docMeaningRefs[pos];
+            if (!posRec)
+                break;
 
-            for (const json& meaningRef : meaningRefs)
-            {
-                meaningRefIds.push_back(meaningRef[FLD_ID]);
-            }
+            const uint64_t *ids = wiktdb->meaningIdList(*posRec);
+            meaningRefIds.insert(meaningRefIds.end(), ids, ids + posRec->numMeanings);
         }
         else
         {
-            const json& meaningPosRefs = termRef[FLD_LANGS][lang][FLD_MEANINGS];
-            json::const_iterator begin = meaningPosRefs.begin();
-            json::const_iterator end = meaningPosRefs.end();
-
-            for (auto posIt = begin; posIt != end; ++posIt)
+            for (uint i = 0; i < langRec->numPos; i++)
             {
-                string pos = string(posIt.key());
-
-                const json& meaningRefs = docMeaningRefs[pos];
-
-                for (const json& meaningRef : meaningRefs)
-                {
-                    meaningRefIds.push_back(meaningRef[FLD_ID]);
-                }
+                const PosRecord& posRec = wiktdb->posRecord(*langRec, i);
+                const uint64_t *ids = wiktdb->meaningIdList(posRec);
+                meaningRefIds.insert(meaningRefIds.end(), ids, ids + posRec.numMeanings);
             }
         }
     }
@@ -934,87 +908,204 @@ vector<std::pair<ulong, float>> MeaningExtractor::similar(const string& term, ui
     return similarRepr(vec1, size, reversed, pos);
 }
 
-vector<std::pair<ulong, float>> MeaningExtractor::similarRepr(const SparseArray& vec, uint size, bool reversed)
-{
-    return similarRepr(vec, size, reversed, "");
+vector<std::pair<ulong, float>> MeaningExtractor::similarRepr(const SparseArray& vec, uint size, bool reversed)
+{
+    return similarRepr(vec, size, reversed, "");
+}
+
+vector<std::pair<ulong, float>> MeaningExtractor::similarRepr(const SparseArray& vec, uint size, bool reversed, const string& pos)
+{
+    return similarRepr(vec, size, reversed, pos, "");
+}
+
+vector<std::pair<ulong, float>> MeaningExtractor::similarRepr(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang)
+{
+    return similarRepr(vec, size, reversed, pos, lang, false);
+}
+
+// Approximate searches use the LSH index if it was built (lsh_tables > 0), the exact search otherwise.
+vector<std::pair<ulong, float>> MeaningExtractor::similarRepr(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang, bool approx)
+{
+    if (approx && lshIndex.isBuilt() && !vec.empty())
+        return lshIndex.similar(vec, size, reversed, similarityIndex.partitionRanges(pos, lang));
+
+    if (config.similarSearch == SIMILAR_SEARCH_EXACT || !similarityIndex.isBuilt())
+        return similarReprExact(vec, size, reversed, pos, lang);
+
+    vector<std::pair<ulong, float>> results = shardedScan(similarityIndex.partitionRanges(pos, lang), size, reversed,
+        [&](const vector<std::pair<uint, uint>>& ranges, TopK& topK) { similarityIndex.similar(vec, size, reversed, ranges, topK); });
+
+    if (config.similarSearch == SIMILAR_SEARCH_VERIFY)
+    {
+        // Brute force over the cached meanings, so that the partitioning is checked too.
+        vector<std::pair<ulong, float>> exactResults = similarReprScan(vec, size, reversed, pos, lang);
+
+        if (results != exactResults)
+        {
+            std::cerr << "Similarity index results differ from the exhaustive scan." << std::endl;
+            return exactResults;
+        }
+    }
+
+    return results;
+}
+
+vector<std::pair<ulong, float>> MeaningExtractor::similarReprExact(const SparseArray& vec, uint size, bool reversed, const string& pos)
+{
+    return similarReprExact(vec, size, reversed, pos, "");
+}
+
+vector<std::pair<ulong, float>> MeaningExtractor::similarReprExact(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang)
+{
+    float vecNorm = vec.norm();
+
+    if (similarityIndex.isBuilt())
+    {
+        // Only the matching POS/language partitions are scanned.
+        return shardedScan(similarityIndex.partitionRanges(pos, lang), size, reversed,
+                           [&](const vector<std::pair<uint, uint>>& ranges, TopK& topK)
+        {
+            for (const std::pair<uint, uint>& range : ranges)
+            {
+                for (uint slot = range.first; slot < range.second; slot++)
+                {
+                    const Meaning& meaning = similarityIndex.slotMeaning(slot);
+                    topK.push(similarityIndex.slotId(slot), SparseArray::cosine(vec, meaning.repr, vecNorm, meaning.norm));
+                }
+            }
+        });
+    }
+
+    return similarReprScan(vec, size, reversed, pos, lang);
 }
 
-vector<std::pair<ulong, float>> MeaningExtractor::similarRepr(const SparseArray& vec, uint size, bool reversed, const string& pos)
+vector<std::pair<ulong, float>> MeaningExtractor::similarReprScan(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang)
 {
-    vector<std::pair<ulong, float>> compTerms(MeaningExtractor::reprCache.size());
+    TopK compTerms(size, reversed);
+    float vecNorm = vec.norm();
 
-    ulong i = 0;
     for (auto it = MeaningExtractor::reprCache.begin(); it != MeaningExtractor::reprCache.end(); ++it)
     {
-        Meaning& meaning = it->second;
-        const SparseArray& vec2 = meaning.getVector();
-
-        if (pos == "" || meaning.pos == pos)
-            compTerms[i] = std::make_pair(it->first, SparseArray::cosine(vec, vec2));
+        const Meaning& meaning = it->second;
 
-        i++;
+        if ((pos == "" || meaning.pos == pos) && (lang == "" || meaning.lang == lang))
+            compTerms.push(it->first, SparseArray::cosine(vec, meaning.repr, vecNorm, meaning.norm));
     }
 
-    std::sort(compTerms.begin(), compTerms.end(), distComparator);
+    return compTerms.results();
+}
+
+// Splits the candidate slot ranges in shards scanned in parallel, each into its own top-k selection, and merges them.
+vector<std::pair<ulong, float>> MeaningExtractor::shardedScan(const vector<std::pair<uint, uint>>& ranges, uint size, bool reversed,
+                                                              const std::function<void(const vector<std::pair<uint, uint>>&, TopK&)>& scan)
+{
+    ulong numCandidates = 0;
+    uint numShards = (config.similarThreads > 0) ? config.similarThreads : threadPool().size();
+
+    for (const std::pair<uint, uint>& range : ranges)
+        numCandidates += range.second - range.first;
 
-    vector<std::pair<ulong, float>> results;
-    for (uint i = 0; i < size; i++)
+    numShards = std::max(1ul, std::min<ulong>(numShards, numCandidates / SIMILAR_MIN_SHARD_SIZE));
+
+    vector<TopK> shardTopK(numShards, TopK(size, reversed));
+
+    if (numShards == 1)
     {
-        if (!reversed)
-        {
-            results.push_back(compTerms.back());
-            compTerms.pop_back();
-        }
-        else
+        scan(ranges, shardTopK[0]);
+    }
+    else
+    {
+        threadPool().parallelFor(numShards, [&](ulong shard, uint worker)
         {
-            results.push_back(compTerms[i]);
-        }
+            scan(SimilarityIndex::shardRanges(ranges, shard, numShards), shardTopK[shard]);
+        });
     }
 
-    return results;
+    for (uint shard = 1; shard < numShards; shard++)
+        shardTopK[0].merge(shardTopK[shard]);
+
+    return shardTopK[0].results();
 }
 
-Meaning& MeaningExtractor::disambiguate(const string& term, const string& pos, const vector<string>& context)
+const Meaning& MeaningExtractor::disambiguate(const string& term, const string& pos, const vector<string>& context)
 {
+    static const Meaning noMeaning = Meaning();
     vector<ulong> meaningRefIds = getMeaningRefIds(term, pos);
-    vector<std::pair<ulong, float>> contextDist(meaningRefIds.size());
-    uint i = 0;
+    vector<std::pair<ulong, float>> contextDist;
+    vector<Meaning> ctxMeanings;
+
+    for (const string& ctxTerm : context)
+        ctxMeanings.push_back(Meaning(ctxTerm));
 
     for (ulong mRefId : meaningRefIds)
     {
-        Meaning& meaning = MeaningExtractor::reprCache[mRefId];
-        contextDist[i] = std::make_pair(mRefId, 0);
+        auto cacheIt = MeaningExtractor::reprCache.find(mRefId);
+
+        if (cacheIt == MeaningExtractor::reprCache.end())
+            continue;
+
+        contextDist.push_back(std::make_pair(mRefId, 0));
 
-        for (const string& ctxTerm : context)
+        for (const Meaning& ctxMeaning : ctxMeanings)
         {
-            contextDist[i].second += std::fabs(SparseArray::cosine(meaning.repr, Meaning(ctxTerm).getVector()));
+            contextDist.back().second += std::fabs(SparseArray::cosine(cacheIt->second.repr, ctxMeaning.repr, cacheIt->second.norm, ctxMeaning.norm));
         }
-
-        i++;
     }
 
+    if (contextDist.empty())
+        return noMeaning;
+
     std::sort(contextDist.begin(), contextDist.end(), distComparator);
 
-    return MeaningExtractor::reprCache[contextDist.back().first];
+    return MeaningExtractor::reprCache.at(contextDist.back().first);
 
 }
 
 float MeaningExtractor::similarity(const string& term1, const string& pos1, const string& term2, const string& pos2, const vector<string>& context, float scale)
 {
-    SparseArray vec1, vec2;
-    //MeaningExtractor::graphFill = true;
-    MeaningExtractor::graphFill = false;
-    uint linkSearchDepth = MeaningExtractor::linkSearchDepth;
-    MeaningExtractor::linkSearchDepth = 1;
-
     Meaning concept1 = (pos1 != "") ? Meaning(term1, pos1) : Meaning(term1);
     Meaning concept2 = (pos2 != "") ? Meaning(term2, pos2) : Meaning(term2);
-    MeaningExtractor::graphFill = false;
-    MeaningExtractor::linkSearchDepth = linkSearchDepth;
 
     return MeaningExtractor::similarity(concept1, concept2, scale);
 }
 
+// Batch version of similarity(term1, pos1, term2, pos2, context, scale): the vector of each distinct (term, POS)
+// is built once, then pairs are scored in parallel.
+vector<float> MeaningExtractor::similarity(const vector<SimilarityQuery>& queries)
+{
+    std::map<std::pair<string, string>, ulong> conceptIdx;
+    vector<const std::pair<string, string>*> conceptKeys;
+    vector<std::pair<ulong, ulong>> queryConcepts;
+
+    for (const SimilarityQuery& query : queries)
+    {
+        auto it1 = conceptIdx.insert(std::make_pair(std::make_pair(query.term1, query.pos1), conceptIdx.size())).first;
+        auto it2 = conceptIdx.insert(std::make_pair(std::make_pair(query.term2, query.pos2), conceptIdx.size())).first;
+        queryConcepts.push_back(std::make_pair(it1->second, it2->second));
+    }
+
+    conceptKeys.resize(conceptIdx.size());
+    for (auto it = conceptIdx.begin(); it != conceptIdx.end(); ++it)
+        conceptKeys[it->second] = &it->first;
+
+    vector<Meaning> concepts(conceptKeys.size());
+    vector<float> scores(queries.size());
+
+    threadPool().parallelFor(concepts.size(), [&](ulong i, uint worker)
+    {
+        const string& term = conceptKeys[i]->first;
+        const string& pos = conceptKeys[i]->second;
+        concepts[i] = (pos != "") ? Meaning(term, pos) : Meaning(term);
+    });
+
+    threadPool().parallelFor(queries.size(), [&](ulong i, uint worker)
+    {
+        scores[i] = similarity(concepts[queryConcepts[i].first], concepts[queryConcepts[i].second], queries[i].scale);
+    });
+
+    return scores;
+}
+
 float MeaningExtractor::similarity(const Meaning& concept1, const Meaning& concept2, float scale)
 {
     SparseArray vec1, vec2;
@@ -1111,106 +1202,194 @@ float MeaningExtractor::similarity(const Meaning& concept1, const Meaning& conce
     return SparseArray::weightedCosine(vec1, vec2, 1.0, scale);
 }
 
-float MeaningExtractor::similarity(const Meaning& concept1, const Meaning& concept2, float scale)
+bool MeaningExtractor::isSnapshot(const string& filename)
 {
-    SparseArray vec1, vec2;
+    char magic[MEANING_SNAPSHOT_MAGIC_SIZE];
+    std::ifstream ifile(filename, std::ios::binary);
 
-    vec1 = concept1.repr;
-    vec2 = concept2.repr;
-    const string& term1 = concept1.term;
-    const string& term2 = concept2.term; 
-    float linkSynWeight = MeaningExtractor::config.linkWeights.link_syn;
-    const float synWeightMult = SIM_SYNWEIGHT_MULTIPLIER;
+    if (!ifile.read(magic, MEANING_SNAPSHOT_MAGIC_SIZE))
+        return false;
 
-    if (SparseArray::keyIntersectionSize(vec1, vec2) == 0)
-        return 0.0;
+    return memcmp(magic, MEANING_SNAPSHOT_MAGIC, MEANING_SNAPSHOT_MAGIC_SIZE) == 0;
+}
 
-    
-    ulong idx_synterm1 = wiktdb->size() * ReprOffsetBase::synonym + wiktdb->index(term1);
-    ulong idx_synterm2 = wiktdb->size() * ReprOffsetBase::synonym + wiktdb->index(term2);
-    ulong idx_strterm1 = wiktdb->size() * ReprOffsetBase::strong + wiktdb->index(term1);
-    ulong idx_strterm2 = wiktdb->size() * ReprOffsetBase::strong + wiktdb->index(term2);
+void MeaningExtractor::writeSnapshot(const string& filename)
+{
+    std::ofstream ofile(filename, std::ios::binary);
+    MeaningSnapshotHeader header = MeaningSnapshotHeader();
+    umap<string, StringRecord> stringRecs;
+    vector<char> stringData;
+    vector<MeaningRecord> meaningRecs;
+    vector<uint64_t> vecOffsets(1, 0);
+    const char padding[8] = {0};
+
+    if (!ofile)
+        throw std::runtime_error("Error opening meaning snapshot for writing: " + filename);
+
+    // Terms, POS and languages repeat across meanings, so the string table stores each string once.
+    auto addString = [&](const string& str) -> StringRecord
+    {
+        auto strIt = stringRecs.find(str);
+        if (strIt != stringRecs.end())
+            return strIt->second;
 
-    if (wiktdb->exists(term1 + " " + term2) || wiktdb->exists(term2 + " " + term1))
+        StringRecord strRec = StringRecord();
+        strRec.offset = stringData.size();
+        strRec.length = str.size();
+        stringData.insert(stringData.end(), str.begin(), str.end());
+        stringRecs[str] = strRec;
+
+        return strRec;
+    };
+
+    for (auto it = MeaningExtractor::reprCache.begin(); it != MeaningExtractor::reprCache.end(); ++it)
     {
-        return SIM_EXPR_FIXED_GUESS;
+        MeaningRecord meaningRec;
+        meaningRec.id = it->first;
+        meaningRec.term = addString(it->second.term);
+        meaningRec.pos = addString(it->second.pos);
+        meaningRec.descr = addString(it->second.descr);
+        meaningRec.lang = addString(it->second.lang);
+        meaningRecs.push_back(meaningRec);
+
+        vecOffsets.push_back(vecOffsets.back() + it->second.repr.size());
     }
 
-    if (vec1.count(idx_strterm2))
+    auto writeSection = [&](const void *data, ulong size) -> ulong
     {
-        vec1[idx_strterm2] += linkSynWeight * synWeightMult;
-        vec2[idx_strterm2] = linkSynWeight * synWeightMult;
-    }
+        ulong offset = ofile.tellp();
+        ofile.write((const char*)data, size);
+        ofile.write(padding, (8 - size % 8) % 8);
+        return offset;
+    };
+
+    memcpy(header.magic, MEANING_SNAPSHOT_MAGIC, MEANING_SNAPSHOT_MAGIC_SIZE);
+    header.version = MEANING_SNAPSHOT_VERSION;
+    header.headerSize = sizeof(MeaningSnapshotHeader);
+    header.numMeanings = meaningRecs.size();
+    header.numEntries = vecOffsets.back();
+    writeSection(&header, sizeof(header));
+
+    header.stringsSize = stringData.size();
+    header.stringsOffset = writeSection(stringData.data(), stringData.size());
+    header.meaningsOffset = writeSection(meaningRecs.data(), meaningRecs.size() * sizeof(MeaningRecord));
+    header.vecOffsetsOffset = writeSection(vecOffsets.data(), vecOffsets.size() * sizeof(uint64_t));
+
+    // Vectors are written one at a time, keys first, then values.
+    header.keysOffset = ofile.tellp();
+    for (auto it = MeaningExtractor::reprCache.begin(); it != MeaningExtractor::reprCache.end(); ++it)
+        ofile.write((const char*)it->second.repr.keyData(), it->second.repr.size() * sizeof(uint));
+    ofile.write(padding, (8 - (header.numEntries * sizeof(uint)) % 8) % 8);
 
-    if (vec2.count(idx_strterm1))
+    header.valuesOffset = ofile.tellp();
+    for (auto it = MeaningExtractor::reprCache.begin(); it != MeaningExtractor::reprCache.end(); ++it)
+        ofile.write((const char*)it->second.repr.valueData(), it->second.repr.size() * sizeof(float));
+
+    ofile.seekp(0);
+    ofile.write((const char*)&header, sizeof(header));
+    ofile.close();
+
+    if (!ofile)
+        throw std::runtime_error("Error writing meaning snapshot: " + filename);
+}
+
+void MeaningExtractor::loadSnapshot(const string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat fileStat;
+
+    if (fd < 0)
+        throw std::runtime_error("Error opening meaning snapshot: " + filename);
+
+    if (fstat(fd, &fileStat) < 0)
     {
-        vec2[idx_strterm1] += linkSynWeight * synWeightMult;
-        vec1[idx_strterm1] = linkSynWeight * synWeightMult;
+        close(fd);
+        throw std::runtime_error("Error opening meaning snapshot: " + filename);
     }
 
-    if (vec1.count(idx_synterm2) || vec2.count(idx_synterm1))
-    {
-        float syn_scaling = linkSynWeight;
+    ulong snapshotSize = fileStat.st_size;
+    void *snapshot = mmap(nullptr, snapshotSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
 
-        if (vec1.count(idx_synterm2) && vec2.count(idx_synterm1))
-            syn_scaling *= 2;
+    if (snapshot == MAP_FAILED)
+        throw std::runtime_error("Error mapping meaning snapshot: " + filename);
 
-        if (std::fabs(vec1.get(idx_synterm2)) > 0)
-        {
-            vec1[idx_synterm2] *= syn_scaling;
-            vec1[idx_synterm1] = std::fabs(vec1[idx_synterm2]);
+    const char *base = (const char*)snapshot;
+    const MeaningSnapshotHeader *header = (const MeaningSnapshotHeader*)base;
 
-            if (std::fabs(vec1[idx_synterm2]) > std::fabs(vec2[idx_synterm2]))
-                vec2[idx_synterm2] = std::fabs(vec1[idx_synterm2]);
-            else
-                vec1[idx_synterm2] =  (vec1[idx_synterm2] / std::fabs(vec1[idx_synterm2])) * vec2[idx_synterm2];
+    if (snapshotSize < sizeof(MeaningSnapshotHeader) || header->version != MEANING_SNAPSHOT_VERSION || header->headerSize != sizeof(MeaningSnapshotHeader))
+    {
+        munmap(snapshot, snapshotSize);
+        throw std::runtime_error("Incompatible meaning snapshot: " + filename + " (expected version " + std::to_string(MEANING_SNAPSHOT_VERSION) + ")");
+    }
 
-        }
-        else if (std::fabs(vec2.get(idx_synterm1)) > 0)
-        {
-            vec2[idx_synterm1] *= syn_scaling;
-            vec2[idx_synterm2] = std::fabs(vec2[idx_synterm1]);
+    // Everything the records refer to is checked before any meaning is added.
+    auto rangeFits = [](uint64_t first, uint64_t num, uint64_t size) { return first <= size && num <= size - first; };
+    auto sectionFits = [&](uint64_t offset, uint64_t num, uint64_t recordSize)
+    {
+        return offset % 8 == 0 && offset <= snapshotSize && num <= (snapshotSize - offset) / recordSize;
+    };
+    auto corrupt = [&](const string& what)
+    {
+        munmap(snapshot, snapshotSize);
+        throw std::runtime_error("Corrupt meaning snapshot: " + filename + ": " + what + " out of bounds");
+    };
 
-            if (std::fabs(vec2[idx_synterm1]) > std::fabs(vec1[idx_synterm1]))
-                vec1[idx_synterm1] = std::fabs(vec2[idx_synterm1]);
-            else
-                vec2[idx_synterm1] = (vec2[idx_synterm1] / std::fabs(vec2[idx_synterm1])) * vec1[idx_synterm1];
-        }
+    if (!sectionFits(header->stringsOffset, header->stringsSize, 1) || !sectionFits(header->meaningsOffset, header->numMeanings, sizeof(MeaningRecord)) ||
+        !sectionFits(header->vecOffsetsOffset, header->numMeanings + 1, sizeof(uint64_t)) ||
+        !sectionFits(header->keysOffset, header->numEntries, sizeof(uint)) || !sectionFits(header->valuesOffset, header->numEntries, sizeof(float)))
+    {
+        corrupt("section");
+    }
 
-        for (auto it = vec1.begin(); it != vec1.end(); ++it)
-        {
-            if (it->first < wiktdb->size() * ReprOffsetBase::synonym || it->first >= wiktdb->size() * (ReprOffsetBase::synonym + 1))
-            {
-                if (it->second < linkSynWeight)
-                    it->second = 0;
-            }
-            else if (std::fabs(it->second) < std::fabs(vec1[idx_synterm2]))
-            {
-                it->second = 0;
-            }
-        }
+    const char *strings = base + header->stringsOffset;
+    const MeaningRecord *meaningRecs = (const MeaningRecord*)(base + header->meaningsOffset);
+    const uint64_t *vecOffsets = (const uint64_t*)(base + header->vecOffsetsOffset);
+    const uint *keys = (const uint*)(base + header->keysOffset);
+    const float *values = (const float*)(base + header->valuesOffset);
+    auto stringFits = [&](const StringRecord& strRec) { return rangeFits(strRec.offset, strRec.length, header->stringsSize); };
 
-        for (auto it = vec2.begin(); it != vec2.end(); ++it)
+    for (ulong i = 0; i < header->numMeanings; i++)
+    {
+        const MeaningRecord& meaningRec = meaningRecs[i];
+
+        if (!stringFits(meaningRec.term) || !stringFits(meaningRec.pos) || !stringFits(meaningRec.descr) || !stringFits(meaningRec.lang) ||
+            vecOffsets[i] > vecOffsets[i + 1] || vecOffsets[i + 1] > header->numEntries)
         {
-            if (it->first < wiktdb->size() * ReprOffsetBase::synonym || it->first >= wiktdb->size() * (ReprOffsetBase::synonym + 1))
-            {
-                if (it->second < linkSynWeight)
-                    it->second = 0;
-            }
-            else if (std::fabs(it->second) < std::fabs(vec2[idx_synterm1]))
-            {
-                it->second = 0;
-            }
+            corrupt("meaning record " + std::to_string(i));
         }
     }
 
-    return SparseArray::weightedCosine(vec1, vec2, 1.0, scale);
+    // No reserve: reprCache iterates in the same order as when loaded from JSON.
+    for (ulong i = 0; i < header->numMeanings; i++)
+    {
+        const MeaningRecord& meaningRec = meaningRecs[i];
+        Meaning& meaning = MeaningExtractor::reprCache[meaningRec.id];
+
+        meaning.term.assign(strings + meaningRec.term.offset, meaningRec.term.length);
+        meaning.pos.assign(strings + meaningRec.pos.offset, meaningRec.pos.length);
+        meaning.descr.assign(strings + meaningRec.descr.offset, meaningRec.descr.length);
+        meaning.lang.assign(strings + meaningRec.lang.offset, meaningRec.lang.length);
+        meaning.repr = SparseArray::fromSortedArrays(keys + vecOffsets[i], values + vecOffsets[i], vecOffsets[i + 1] - vecOffsets[i]);
+        meaning.updateNorm();
+    }
+
+    munmap(snapshot, snapshotSize);
 }
 
 void MeaningExtractor::loadVectorsFromFile(const string& meaningFilename)
 {
     json meaningList;
 
+    if (isSnapshot(meaningFilename))
+    {
+        loadSnapshot(meaningFilename);
+        buildSimilarityIndex();
+        MeaningExtractor::vectorsLoaded = true;
+
+        return;
+    }
+
     try
     {
         std::ifstream ifile(meaningFilename);
@@ -1232,155 +1411,274 @@ void MeaningExtractor::loadVectorsFromFile(const string& meaningFilename)
         meaning.descr = (*it)[FLD_DESCR];
         meaning.lang = (*it)[FLD_LANG];
         meaning.repr = fromJsonRepr((*it)[FLD_REPR], config.humanReadable);
+        meaning.repr.shrinkToFit();
+        meaning.updateNorm();
 
         MeaningExtractor::reprCache[(*it)[FLD_ID]] = meaning;
     }
 
+    buildSimilarityIndex();
+
     MeaningExtractor::vectorsLoaded = true;
 }
 
-void MeaningExtractor::preloadVectors()
+void MeaningExtractor::extractMeanings(const string& term, vector<std::pair<ulong, Meaning>>& meanings)
 {
-    if (MeaningExtractor::vectorsLoaded)
-        return;
-
-    ulong progressCount = 0;
+    EntryRef termEntry = wiktdb->entry(term);
+    const json& termRef = *termEntry;
 
-    for (auto it = wiktdb->invIndex.begin(); it != wiktdb->invIndex.end(); ++it)
+    for (const string& lang : MeaningExtractor::config.languages)
     {
-        const json& termRef = (*wiktdb)[it->first];
+        if (!termRef[FLD_LANGS].count(lang))
+            continue;
 
-        for (const string& lang : MeaningExtractor::config.languages)
-        {
-            if (!termRef[FLD_LANGS].count(lang))
-                continue;
+        const json& meaningPosRefs = termRef[FLD_LANGS][lang][FLD_MEANINGS];
+        json::const_iterator begin = meaningPosRefs.begin();
+        json::const_iterator end = meaningPosRefs.end();
 
-            const json& meaningPosRefs = termRef[FLD_LANGS][lang][FLD_MEANINGS];
-            json::const_iterator begin = meaningPosRefs.begin();
-            json::const_iterator end = meaningPosRefs.end();
+        for (auto posIt = begin; posIt != end; ++posIt)
+        {
+            string pos = string(posIt.key());
+            const json& meaningRefs = meaningPosRefs[pos];
 
-            for (auto posIt = begin; posIt != end; ++posIt)
+            for (const json& meaningRef : meaningRefs)
             {
-                string pos = string(posIt.key());
-                const json& meaningRefs = meaningPosRefs[pos];
-
-                for (const json& meaningRef : meaningRefs)
+                SparseArray vec = MeaningExtractor::getMeaningVector(meaningRef[FLD_ID]);
+                Meaning meaning(vec);
+                meaning.term = termRef[FLD_TITLE];
+                meaning.pos = pos;
+                meaning.descr = meaningRef[FLD_MEANING_DESCR];
+                meaning.lang = lang;
+
+                if (meaningRef.count(FLD_EXAMPLES))
                 {
-                    SparseArray vec = MeaningExtractor::getVector(meaningRef, termRef, pos);
-                    Meaning meaning(vec);
-                    meaning.term = termRef[FLD_TITLE];
-                    meaning.pos = pos;
-                    meaning.descr = meaningRef[FLD_MEANING_DESCR];
-                    meaning.lang = lang;
-
-                    if (meaningRef.count(FLD_EXAMPLES))
+                    for (const string& example : meaningRef[FLD_EXAMPLES])
                     {
-                        for (const string& example : meaningRef[FLD_EXAMPLES])
-                        {
-                            Example ex;
-                            std::smatch mo;
-
-                            ex.sentence = std::regex_replace(example, MARKUP_WIKI_RGX, "$3");
-                            ex.sentence = std::regex_replace(ex.sentence, MARKUP_LABEL_RGX, "$3");
-                            std::regex_search(example, mo, EXAMPLE_RGX);
-                            for (uint i = 1; i < mo.size(); i++)
-                            {
-                                ex.termStartEndPositions.push_back(std::make_pair(mo.position(i) - (i * 3), mo.position(i) - (i * 3) +  mo[i].length() - 1));
-                            }
-                            
-                            ex.sentence = std::regex_replace(ex.sentence, EXAMPLE_RGX, "$1");
-                            ex.sentence = std::regex_replace(ex.sentence, MARKUP_FREE_RGX, "");
-                            
-                            if (ex.termStartEndPositions.size() == 0)
-                            {
-                                int start = ex.sentence.find(meaning.term);
+                        Example ex;
+                        std::smatch mo;
 
-                                if (start >= 0)
-                                    ex.termStartEndPositions.push_back(std::make_pair(start, start + meaning.term.length() - 1));
-                            }
+                        ex.sentence = std::regex_replace(example, MARKUP_WIKI_RGX, "$3");
+                        ex.sentence = std::regex_replace(ex.sentence, MARKUP_LABEL_RGX, "$3");
+                        std::regex_search(example, mo, EXAMPLE_RGX);
+                        for (uint i = 1; i < mo.size(); i++)
+                        {
+                            ex.termStartEndPositions.push_back(std::make_pair(mo.position(i) - (i * 3), mo.position(i) - (i * 3) +  mo[i].length() - 1));
+                        }
+                        
+                        ex.sentence = std::regex_replace(ex.sentence, EXAMPLE_RGX, "$1");
+                        ex.sentence = std::regex_replace(ex.sentence, MARKUP_FREE_RGX, "");
+                        
+                        if (ex.termStartEndPositions.size() == 0)
+                        {
+                            int start = ex.sentence.find(meaning.term);
 
-                     
-                            if (ex.termStartEndPositions.size() > 0)
-                                meaning.examples.push_back(ex);
+                            if (start >= 0)
+                                ex.termStartEndPositions.push_back(std::make_pair(start, start + meaning.term.length() - 1));
                         }
+
+                 
+                        if (ex.termStartEndPositions.size() > 0)
+                            meaning.examples.push_back(ex);
                     }
-                    
-                    MeaningExtractor::reprCache[meaningRef[FLD_ID]] = meaning;
                 }
+                
+                meanings.push_back(std::make_pair((ulong)meaningRef[FLD_ID], std::move(meaning)));
+            }
+        }
+    }
+}
+
+ThreadPool& MeaningExtractor::threadPool()
+{
+    static ThreadPool pool(config.numThreads);
+
+    return pool;
+}
+
+static double threadCpuTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void MeaningExtractor::runPhase(const string& name, ulong numTasks, const std::function<void(ulong, uint)>& task)
+{
+    ThreadPool& pool = threadPool();
+    vector<double> busyTime(pool.size(), 0.0);
+    auto start = std::chrono::steady_clock::now();
+
+    pool.parallelFor(numTasks, [&](ulong taskIdx, uint worker)
+    {
+        double taskStart = threadCpuTime();
+        task(taskIdx, worker);
+        busyTime[worker] += threadCpuTime() - taskStart;
+    });
+
+    double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double totalBusyTime = std::accumulate(busyTime.begin(), busyTime.end(), 0.0);
+
+    // Speedup over a serial run, estimated as the CPU time spent in tasks over the elapsed time.
+    printf("%-20s %9.2fs  %5.2fx speedup (%u threads)\n", name.c_str(), wallTime, (wallTime > 0) ? totalBusyTime / wallTime : 1.0, pool.size());
+    fflush(stdout);
+}
+
+void MeaningExtractor::preloadVectors()
+{
+    if (MeaningExtractor::vectorsLoaded)
+        return;
+
+    // Terms are split into chunks, each with its own output buffer. Buffers are merged in chunk order,
+    // so reprCache gets the same insertion (and iteration) order as a single-threaded run.
+    vector<string> terms;
+    for (ulong i = 0; i < wiktdb->size(); i++)
+        terms.push_back(wiktdb->invIndex.term(i).str());
+
+    ulong numChunks = (terms.size() + PRELOAD_CHUNK_SIZE - 1) / PRELOAD_CHUNK_SIZE;
+    vector<vector<std::pair<ulong, Meaning>>> chunkMeanings(numChunks);
+    std::atomic<ulong> progressCount(0);
+
+    runPhase("Vector generation", numChunks, [&](ulong chunk, uint worker)
+    {
+        ulong chunkEnd = std::min((chunk + 1) * PRELOAD_CHUNK_SIZE, (ulong)terms.size());
+
+        for (ulong i = chunk * PRELOAD_CHUNK_SIZE; i < chunkEnd; i++)
+        {
+            extractMeanings(terms[i], chunkMeanings[chunk]);
+
+            ulong count = ++progressCount;
+            uint progress = int(float(count) * 100 / wiktdb->size());
+            if (progress > 0 && progress % 2 == 0 && count % 1000 == 0)
+            {
+                printf("%d%%\r", progress);
+                fflush(stdout);
             }
         }
+    });
 
-        progressCount++;
-        uint progress = int(float(progressCount) * 100 / wiktdb->size());
-        if (progress > 0 && progress % 2 == 0 && progressCount % 1000 == 0)
+    printf("Hypernym chains: %lu memo hits, %lu misses\n", hypernymMemo.hits.load(), hypernymMemo.misses.load());
+
+    // Typed entries are only read in bulk during vector generation.
+    wiktdb->releaseTermEntries();
+
+    runPhase("Merge", 1, [&](ulong, uint)
+    {
+        for (auto& meanings : chunkMeanings)
         {
-            printf("%d%%\r", progress);
-            fflush(stdout);
+            for (auto& meaningPair : meanings)
+                MeaningExtractor::reprCache[meaningPair.first] = std::move(meaningPair.second);
+
+            vector<std::pair<ulong, Meaning>>().swap(meanings);
         }
-    }
+    });
 
     idfWeak();
     markEffective();
-    joinTranslations();
+    runPhase("joinTranslations", 1, [](ulong, uint) { joinTranslations(); });
+
+    vector<Meaning*> meanings = cachedMeanings();
+    runPhase("Compaction", meanings.size(), [&](ulong i, uint) { meanings[i]->repr.shrinkToFit(); });
+    runPhase("Similarity index", 1, [](ulong, uint) { buildSimilarityIndex(); });
 
     MeaningExtractor::vectorsLoaded = true;
 }
 
-void MeaningExtractor::idfWeak()
+void MeaningExtractor::buildSimilarityIndex()
 {
-    float *termIdf = new float[wiktdb->size()];
+    MeaningExtractor::similarityIndex.build(MeaningExtractor::reprCache);
 
-    for (ulong i = 0; i < wiktdb->size(); i++)
-    {
-        termIdf[i] = 0.0;
-    }
+    if (config.lshTables > 0)
+        MeaningExtractor::lshIndex.build(MeaningExtractor::similarityIndex, config.lshTables, config.lshBits, threadPool());
+}
+
+vector<Meaning*> MeaningExtractor::cachedMeanings()
+{
+    vector<Meaning*> meanings;
+    meanings.reserve(MeaningExtractor::reprCache.size());
 
     for (auto cacheIt = MeaningExtractor::reprCache.begin(); cacheIt != MeaningExtractor::reprCache.end(); ++cacheIt)
+        meanings.push_back(&cacheIt->second);
+
+    return meanings;
+}
+
+void MeaningExtractor::idfWeak()
+{
+    vector<Meaning*> meanings = cachedMeanings();
+    ulong numTasks = (meanings.size() + PRELOAD_CHUNK_SIZE - 1) / PRELOAD_CHUNK_SIZE;
+    vector<std::atomic<uint>> termCount(wiktdb->size());
+    float *termIdf = new float[wiktdb->size()];
+
+    runPhase("idfWeak (count)", numTasks, [&](ulong task, uint)
     {
-        SparseArray& vec = cacheIt->second.repr;
-        for (auto vecIt = vec.begin(); vecIt != vec.end(); ++vecIt)
+        for (ulong i = task * PRELOAD_CHUNK_SIZE; i < std::min((task + 1) * PRELOAD_CHUNK_SIZE, (ulong)meanings.size()); i++)
         {
-            if (vecIt->first < wiktdb->size())
+            SparseArray& vec = meanings[i]->repr;
+            for (auto vecIt = vec.begin(); vecIt != vec.end(); ++vecIt)
             {
-                termIdf[vecIt->first]++;
+                if (vecIt->first < wiktdb->size())
+                {
+                    termCount[vecIt->first].fetch_add(1, std::memory_order_relaxed);
+                }
             }
         }
+    });
+
+    // Integer counts convert exactly, so this matches the serial float increments.
+    for (ulong i = 0; i < wiktdb->size(); i++)
+    {
+        termIdf[i] = termCount[i];
     }
 
     float maxIdf = log10(wiktdb->size() / std::max((float)1.0, *std::min_element(termIdf, termIdf + wiktdb->size())));
 
-    for (auto cacheIt = MeaningExtractor::reprCache.begin(); cacheIt != MeaningExtractor::reprCache.end(); ++cacheIt)
+    runPhase("idfWeak (weight)", numTasks, [&](ulong task, uint)
     {
-        SparseArray& vec = cacheIt->second.repr;
-        for (auto vecIt = vec.begin(); vecIt != vec.end(); ++vecIt)
+        for (ulong i = task * PRELOAD_CHUNK_SIZE; i < std::min((task + 1) * PRELOAD_CHUNK_SIZE, (ulong)meanings.size()); i++)
         {
-            if (vecIt->first < wiktdb->size())
+            SparseArray& vec = meanings[i]->repr;
+            for (auto vecIt = vec.begin(); vecIt != vec.end(); ++vecIt)
             {
-                vecIt->second *= log10(wiktdb->size() / termIdf[vecIt->first]) / maxIdf;
+                if (vecIt->first < wiktdb->size())
+                {
+                    vecIt->second *= log10(wiktdb->size() / termIdf[vecIt->first]) / maxIdf;
+                }
             }
+
+            meanings[i]->updateNorm();
         }
-    }
+    });
 
     delete[] termIdf;
 }
 
 void MeaningExtractor::markEffective()
 {
+    vector<Meaning*> meanings = cachedMeanings();
+    ulong numTasks = (meanings.size() + PRELOAD_CHUNK_SIZE - 1) / PRELOAD_CHUNK_SIZE;
+    vector<umap<ulong, ulong>> workerFeatFreq(threadPool().size());
     std::map<ulong, ulong> featFreq;
 
-    for (auto cacheIt = MeaningExtractor::reprCache.begin(); cacheIt != MeaningExtractor::reprCache.end(); ++cacheIt)
+    runPhase("markEffective", numTasks, [&](ulong task, uint worker)
     {
-        SparseArray& vec = cacheIt->second.repr;
-        for (auto vecIt = vec.begin(); vecIt != vec.end(); ++vecIt)
+        for (ulong i = task * PRELOAD_CHUNK_SIZE; i < std::min((task + 1) * PRELOAD_CHUNK_SIZE, (ulong)meanings.size()); i++)
         {
-            if (vecIt->second > 0)
+            const SparseArray& vec = meanings[i]->repr;
+            for (auto vecIt = vec.begin(); vecIt != vec.end(); ++vecIt)
             {
-                if (!featFreq.count(vecIt->first))
-                    featFreq[vecIt->first] = 0;
-                    
-                featFreq[vecIt->first]++;
+                if (vecIt->second > 0)
+                {
+                    workerFeatFreq[worker][vecIt->first]++;
+                }
             }
         }
+    });
+
+    for (auto& freqs : workerFeatFreq)
+    {
+        for (auto pair : freqs)
+            featFreq[pair.first] += pair.second;
     }
 
     ulong idx = 0;
@@ -1413,7 +1711,7 @@ void MeaningExtractor::joinTranslations()
             if (vecIt->first >= wiktdb->invIndex.size() * ReprOffsetBase::translation &&
                 vecIt->first < wiktdb->invIndex.size() * ReprOffsetBase::pos)
             {
-                string term = (*wiktdb)[vecIt->first % wiktdb->size()]["title"].get<string>();
+                string term = wiktdb->title(vecIt->first % wiktdb->size());
                 vector<ulong> meaningRefIds = getMeaningRefIds(term, meaning.pos);
 
                 if (meaningRefIds.size() == 1)
@@ -1453,6 +1751,7 @@ void MeaningExtractor::translationVectorJoin(ulong translIdx, const Meaning& mea
 
     translMeaning.repr[translIdx] = 0;
     translMeaning.repr[wiktdb->linkIndex(meaning.term, ReprOffsetBase::translation)] = config.linkWeights.link_transl;
+    translMeaning.updateNorm();
 }
 
 SparseArray MeaningExtractor::effectiveRepr(const SparseArray& vec)
@@ -1492,7 +1791,7 @@ string MeaningExtractor::stringRepr(const SparseArray& vec, const string separat
                 if (idx < wiktdb->size() * (REPR_OFFSET_BASES[i] + 1))
                 {   
                     if (named)    
-                        strStream << REPR_OFFSET_BASE_NAMES[i] << "@" << (*wiktdb)[offset]["title"].get<string>() << ":" << pair.second;
+                        strStream << REPR_OFFSET_BASE_NAMES[i] << "@" << wiktdb->title(offset) << ":" << pair.second;
                     else
                         strStream << idx << ":" << pair.second;
 
@@ -1556,7 +1855,7 @@ json MeaningExtractor::jsonRepr(const SparseArray& vec, bool named)
             if (idx < wiktdb->size() * (REPR_OFFSET_BASES[i] + 1))
             {
                 if (named)
-                    jRepr[idxStr] = {{"term", (*wiktdb)[offset]["title"].get<string>()}, {"type", REPR_OFFSET_BASE_NAMES[i]}, {"type_id", REPR_OFFSET_BASES[i]}, {"value", pair.second}};
+                    jRepr[idxStr] = {{"term", wiktdb->title(offset)}, {"type", REPR_OFFSET_BASE_NAMES[i]}, {"type_id", REPR_OFFSET_BASES[i]}, {"value", pair.second}};
                 else
                     jRepr[idxStr] = pair.second;
 
@@ -1585,9 +1884,9 @@ SparseArray MeaningExtractor::fromJsonRepr(const json& jsonVec, bool named)
     {
         ulong idx = std::atoll(it.key().c_str());
         if (named)
-            vec[idx] = it.value();
-        else
             vec[idx] = it.value()["value"];
+        else
+            vec[idx] = it.value();
     }
 
     return vec;
@@ -11,14 +11,122 @@
 #include <utility>
 #include <algorithm>
 #include <regex>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+#include <numeric>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "types.h"
 #include "wiktdb.h"
 #include "sparsearray.h"
+#include "similarityindex.h"
+#include "lshindex.h"
 #include "stringutils.h"
 #include "config.h"
+#include "threadpool.h"
 
+//Binary meaning snapshot
+#define MEANING_SNAPSHOT_MAGIC "TDVMEANS"
+#define MEANING_SNAPSHOT_MAGIC_SIZE 8
+#define MEANING_SNAPSHOT_VERSION 1
 
 bool distComparator(const std::pair<ulong, float>& a, const std::pair<ulong, float>& b);
+// Ranking orders for similar searches: by decreasing (or increasing) similarity, ties by meaning ID.
+bool simRankComparator(const std::pair<ulong, float>& a, const std::pair<ulong, float>& b);
+bool dissimRankComparator(const std::pair<ulong, float>& a, const std::pair<ulong, float>& b);
+
+// Bounded selection of the best (meaning ID, score) pairs under a ranking order, in O(N log k).
+class TopK
+{
+    // Heap with the worst kept pair on top.
+    vector<std::pair<ulong, float>> heap;
+    uint size;
+    bool (*rankComparator)(const std::pair<ulong, float>&, const std::pair<ulong, float>&);
+
+    public:
+    TopK(uint size, bool reversed);
+
+    void push(ulong id, float score);
+    // Adds the pairs kept by another selection with the same size and order.
+    void merge(const TopK& other);
+    // Kept pairs in ranking order. Leaves the selection empty.
+    vector<std::pair<ulong, float>> results();
+};
+
+// Binary meaning snapshot layout (native byte order, 8-byte aligned sections):
+// header | string table | meaning records | vector offsets (numMeanings + 1) | vector keys | vector values
+// Vectors are stored in CSR form: the entries of meaning i are [vecOffsets[i], vecOffsets[i + 1]) of the key and value
+// arrays, with keys sorted. Meanings are stored in reprCache order.
+struct MeaningRecord
+{
+    uint64_t id;
+    StringRecord term;
+    StringRecord pos;
+    StringRecord descr;
+    StringRecord lang;
+};
+
+struct MeaningSnapshotHeader
+{
+    char magic[MEANING_SNAPSHOT_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t numMeanings;
+    uint64_t numEntries;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t meaningsOffset;
+    uint64_t vecOffsetsOffset;
+    uint64_t keysOffset;
+    uint64_t valuesOffset;
+};
+
+// Per-call vectorization options, passed explicitly so that concurrent requests do not share mutable state.
+struct VectorOptions
+{
+    // Extend meaning vectors with linked meanings, up to linkSearchDepth links away.
+    bool graphFill = false;
+    uint linkSearchDepth = 1;
+};
+
+// Concurrent memo of hypernym chains (term indices), keyed by head term and remaining depth. Shards are locked separately.
+class HypernymMemo
+{
+    struct Shard
+    {
+        std::mutex mutex;
+        umap<ulong, vector<ulong>> chains;
+    };
+
+    static const uint NUM_SHARDS = 64;
+    Shard shards[NUM_SHARDS];
+
+    public:
+    std::atomic<ulong> hits;
+    std::atomic<ulong> misses;
+
+    HypernymMemo() : hits(0), misses(0) {}
+
+    // Appends the memoized chain to chain, if there is one.
+    bool find(ulong key, vector<ulong>& chain);
+    void insert(ulong key, vector<ulong>::const_iterator begin, vector<ulong>::const_iterator end);
+};
+
+struct SimilarityQuery
+{
+    string term1;
+    string pos1;
+    string term2;
+    string pos2;
+    float scale;
+};
 
 struct Example
 {
@@ -30,6 +138,8 @@ class Meaning
 {
     public:
     SparseArray repr; 
+    // Norm of repr, updated wherever cached meanings are built or modified.
+    float norm = 0;
     string term;
     string pos;
     string descr;
@@ -47,8 +157,9 @@ class Meaning
     Meaning(const string& term, const string& pos, uint index);
     ~Meaning()=default;
      
-    SparseArray getVector();
-    vector<std::pair<ulong, float>> similar(uint size, bool reversed);
+    SparseArray getVector() const;
+    void updateNorm();
+    vector<std::pair<ulong, float>> similar(uint size, bool reversed) const;
 };
 
 class MeaningExtractor
@@ -57,48 +168,74 @@ class MeaningExtractor
     static vector<string> languages;
     static set<string> stopPOSList;
     static bool vectorsLoaded;
+    // IDs of the configured languages, and the noun POS tag, resolved in setDB.
+    static vector<ulong> languageIds;
+    static ulong nounTag;
     
-    static bool findTerm(const string& term, json& termRef);
+    // Entry of the term, referenced in place. Empty if the term is not in the DB.
+    static EntryRef findTerm(const string& term);
     static vector<string> findContext(const json& meaningRef);
-    static void findHypernymChain(vector<string>& hypernyms, const json& meaningRef, int depth, const uint fullDepth);
-    static void fillWeak(SparseArray& vec, const json& meaningRef);
-    static void fillContext(SparseArray& vec, const vector<string>& context);
-    static void fillStrong(SparseArray& vec, const json& meaningRef);
-    static void fillSynonym(SparseArray& vec, const string& pos, const json& meaningRef, const json& termRef, const vector<string>& context);
-    static void fillHypernymChain(SparseArray& vec, const json& meaningRef);
-    static void fillGraph(SparseArray& vec, const string& pos, const json& meaningRef, int depth, const uint fullDepth);
-    static void fillInflec(SparseArray& vec, const json& meaningRef);
-    static void fillMorphoInfo(SparseArray& vec, const string& pos, const json& meaningRef);
-    static void fillTranslation(SparseArray& vec, const string& pos, const json& meaningRef, const json& termRef);
-    static void fillAll(SparseArray& vec, const string& pos, const json& meaningRef, const json& termRef, const vector<string>& context);
-    static bool checkContextSyn(const string& senseWord, const json& meaningRef, const vector<string>& context);
+    static HypernymMemo hypernymMemo;
+
+    // Meaning vectors are filled from the typed entries (see TermEntry): the meaning POS is meaning.posTag.
+    static void findHypernymChain(vector<ulong>& hypernyms, const TermEntry& term, const MeaningEntry& meaning, int depth, const uint fullDepth);
+    static void fillWeak(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning);
+    static void fillContext(SparseArray& vec, const TermEntry& term, IdRange context);
+    static void fillStrong(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning);
+    static void fillSynonym(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning, IdRange context);
+    static void fillHypernymChain(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning);
+    static void fillGraph(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning, int depth, const uint fullDepth);
+    static void fillInflec(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning);
+    static void fillMorphoInfo(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning);
+    static void fillTranslation(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning);
+    static void fillAll(SparseArray& vec, const TermEntry& term, const MeaningEntry& meaning, const VectorOptions& options);
+    static bool checkContextSyn(uint32_t senseWord, const TermEntry& term, const MeaningEntry& meaning, IdRange context);
+    static void extractMeanings(const string& term, vector<std::pair<ulong, Meaning>>& meanings);
+    static void runPhase(const string& name, ulong numTasks, const std::function<void(ulong, uint)>& task);
+    static vector<Meaning*> cachedMeanings();
+    static void loadSnapshot(const string& filename);
+    // Exhaustive scan of the cached meanings, each filtered by its own POS and language.
+    static vector<std::pair<ulong, float>> similarReprScan(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang);
+    static vector<std::pair<ulong, float>> shardedScan(const vector<std::pair<uint, uint>>& ranges, uint size, bool reversed,
+                                                       const std::function<void(const vector<std::pair<uint, uint>>&, TopK&)>& scan);
 
     public:
     static umap<ulong, Meaning> reprCache;
+    static SimilarityIndex similarityIndex;
+    static LshIndex lshIndex;
     static std::map<ulong, ulong> effectiveDims;
-    static bool graphFill;
-    static uint linkSearchDepth;
     static Config config;
     
     static void setDB(WiktDB *wiktdb);
+    static ThreadPool& threadPool();
     static void loadVectorsFromFile(const string& meaningFilename);
+    static void writeSnapshot(const string& filename);
+    static bool isSnapshot(const string& filename);
     static void preloadVectors();
+    static void buildSimilarityIndex();
 
     static SparseArray getVector(const string& term);
     static SparseArray getVector(const string& term, const string& pos);
+    static SparseArray getVector(const string& term, const string& pos, const VectorOptions& options);
     static SparseArray getVector(const string& term, const vector<string>& context);
     static SparseArray getVector(const string& term, const string& pos, const vector<string>& context);
     static SparseArray getVector(const string& term, const string& pos, uint index);
-    static SparseArray getVector(const json& meaningRef, const json& termRef, const string& pos);
+    static SparseArray getMeaningVector(ulong meaningId);
+    static SparseArray getMeaningVector(ulong meaningId, const VectorOptions& options);
     static vector<ulong> getMeaningRefIds(const string& term, const string& pos);
     static vector<std::pair<ulong, float>> similar(const string& term, uint size, bool reversed);
     static vector<std::pair<ulong, float>> similar(const string& term, uint size, bool reversed, const string& pos);
     static vector<std::pair<ulong, float>> similar(const string& term, uint size, bool reversed, const string& pos, const vector<string>& context);
     static vector<std::pair<ulong, float>> similarRepr(const SparseArray& vec, uint size, bool reversed);
     static vector<std::pair<ulong, float>> similarRepr(const SparseArray& vec, uint size, bool reversed, const string& pos);
-    static Meaning& disambiguate(const string& term, const string& pos, const vector<string>& context);
+    static vector<std::pair<ulong, float>> similarRepr(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang);
+    static vector<std::pair<ulong, float>> similarRepr(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang, bool approx);
+    static vector<std::pair<ulong, float>> similarReprExact(const SparseArray& vec, uint size, bool reversed, const string& pos);
+    static vector<std::pair<ulong, float>> similarReprExact(const SparseArray& vec, uint size, bool reversed, const string& pos, const string& lang);
+    static const Meaning& disambiguate(const string& term, const string& pos, const vector<string>& context);
     static float similarity(const string& term1, const string& pos1, const string& term2, const string& pos2, const vector<string>& context, float scale);
     static float similarity(const Meaning& concept1, const Meaning& concept2, float scale);
+    static vector<float> similarity(const vector<SimilarityQuery>& queries);
 
     static void idfWeak();
     static void markEffective();
@@ -1,6 +1,18 @@
 #include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <unordered_map>
 #include <fstream>
+#include <stdexcept>
+#include <functional>
+#include <chrono>
+#include <exception>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "wiktdb.h"
 #include "types.h"
 
@@ -9,92 +21,761 @@ using nlohmann::json;
 WiktDB::~WiktDB()
 {
     delete db;
+
+    if (image)
+        munmap(image, imageSize);
 }
 
-void WiktDB::loadDB(const string& filename)
+void WiktDB::loadDB(const string& filename, ulong cacheSize, ThreadPool *pool)
 {
     if (isLoaded)
         return;
 
-    json jsondb;
+    cache.setCapacity(cacheSize);
+    termEntryCache.setCapacity(cacheSize);
+    auto start = std::chrono::steady_clock::now();
+
+    if (isImage(filename))
+        loadImage(filename);
+    else if (pool && pool->size() > 1)
+        loadJSONParallel(filename, *pool);
+    else
+        loadJSON(filename);
+
+    if (!isCached())
+    {
+        termEntries.resize(invIndex.size());
+        termEntryFlags.reset(new std::once_flag[invIndex.size()]);
+    }
+
+    isLoaded = true;
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("WiktDB: %lu terms loaded in %.2fs, peak RSS %.1f MB\n", (ulong)invIndex.size(), elapsed, peakRSS() / 1048576.0);
+}
+
+ulong WiktDB::peakRSS()
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+        return 0;
+
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024ul;
+#endif
+}
+
+bool WiktDB::isImage(const string& filename)
+{
+    char magic[WIKTDB_IMAGE_MAGIC_SIZE];
+    std::ifstream ifile(filename, std::ios::binary);
+
+    if (!ifile.read(magic, WIKTDB_IMAGE_MAGIC_SIZE))
+        return false;
+
+    return memcmp(magic, WIKTDB_IMAGE_MAGIC, WIKTDB_IMAGE_MAGIC_SIZE) == 0;
+}
+
+// SAX handler that builds the top-level entries of the DB one at a time, and hands each one over when complete,
+// so that the whole document is never held in memory.
+class EntrySaxHandler : public nlohmann::json_sax<json>
+{
+    std::function<void(json&)> onEntry;
+    json entry;
+    // Open containers of the entry under construction, innermost last, and the member the next object value goes to.
+    vector<json*> containers;
+    json *member = nullptr;
+    ulong depth = 0;
+    std::string filename;
+
+    // Values at depth 1 are entries; deeper values are added to the entry under construction.
+    bool inEntry() const { return !containers.empty(); }
+
+    // Adds the value to the innermost open container, and returns where it is stored.
+    json* addValue(json&& value)
+    {
+        json& container = *containers.back();
+
+        if (container.is_array())
+        {
+            container.push_back(std::move(value));
+            return &container.back();
+        }
+
+        *member = std::move(value);
+        return member;
+    }
+
+    bool scalar(json&& value)
+    {
+        if (inEntry())
+            addValue(std::move(value));
+
+        return true;
+    }
+
+    void openContainer(json&& container)
+    {
+        // Containers are only added to while they are innermost, so the pointers stay valid while they are open.
+        if (depth == 2)
+        {
+            entry = std::move(container);
+            containers.push_back(&entry);
+        }
+        else if (inEntry())
+        {
+            containers.push_back(addValue(std::move(container)));
+        }
+    }
+
+    void closeContainer()
+    {
+        if (inEntry())
+            containers.pop_back();
 
+        // Objects at depth 2 are entries.
+        if (depth-- == 2 && entry.is_object())
+        {
+            onEntry(entry);
+            entry = json();
+        }
+    }
+
+    public:
+    EntrySaxHandler(const std::string& filename, const std::function<void(json&)>& onEntry) : onEntry(onEntry), filename(filename) {}
+
+    bool null() override { return scalar(json()); }
+    bool boolean(bool val) override { return scalar(json(val)); }
+    bool number_integer(number_integer_t val) override { return scalar(json(val)); }
+    bool number_unsigned(number_unsigned_t val) override { return scalar(json(val)); }
+    bool number_float(number_float_t val, const string_t&) override { return scalar(json(val)); }
+    bool string(string_t& val) override { return scalar(json(std::move(val))); }
+
+    bool key(string_t& val) override
+    {
+        if (inEntry())
+            member = &(*containers.back())[val];
+
+        return true;
+    }
+
+    bool start_object(std::size_t) override
+    {
+        ++depth;
+        openContainer(json::object());
+        return true;
+    }
+
+    bool end_object() override
+    {
+        closeContainer();
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        ++depth;
+
+        // Arrays at depth 2 are skipped, with everything in them.
+        if (depth != 2)
+            openContainer(json::array());
+
+        return true;
+    }
+
+    bool end_array() override
+    {
+        closeContainer();
+        return true;
+    }
+
+    bool parse_error(std::size_t position, const std::string&, const json::exception& ex) override
+    {
+        throw std::runtime_error("Error parsing DB: " + filename + ": at byte " + std::to_string(position) + ": " + ex.what());
+    }
+};
+
+void WiktDB::loadJSON(const string& filename)
+{
     std::ifstream ifile(filename);
-    ifile >> jsondb;
-    auto size = jsondb.size();
-    db = new vector<json>(size);
-    
-    ulong i = 0;
-    ulong posCount = 0;
-    for (auto it = jsondb.begin(); it != jsondb.end(); ++it) {
-        if (!invIndex.count((*it)[FLD_TITLE]))
-        {
-            (*db)[i] = it.value();
-            invIndex[(*it)[FLD_TITLE]] = i;
-            
-            uint langOffset = 0;
-            json& termLangRefs = (*db)[i][FLD_LANGS];
-            for (json& termLangRef : termLangRefs)
+
+    if (!ifile)
+        throw std::runtime_error("Error opening DB: " + filename);
+
+    db = new vector<json>();
+
+    EntrySaxHandler handler(filename, [this](json& entry) { addEntry(entry); });
+    json::sax_parse(ifile, &handler);
+
+    finishJSON();
+}
+
+// Byte ranges of the objects in the top-level array of a JSON text, found by tracking nesting and strings only.
+// Other top-level values are skipped, as in EntrySaxHandler, once checked to be valid JSON. Syntax inside the ranges
+// is checked when they are parsed, and syntax around them here: whitespace, the enclosing brackets and single commas
+// between the values.
+static vector<std::pair<ulong, ulong>> entryRanges(const char *text, ulong size, const string& filename)
+{
+    enum ArrayState { beforeArray, firstValue, nextValue, afterValue, afterArray };
+    vector<std::pair<ulong, ulong>> ranges;
+    ArrayState state = beforeArray;
+    ulong depth = 0;
+    ulong start = 0;
+    char opener = 0;
+    bool inString = false;
+
+    auto unexpected = [&](ulong pos)
+    {
+        throw std::runtime_error("Error parsing DB: " + filename + ": unexpected '" + text[pos] + "' at byte " + std::to_string(pos));
+    };
+
+    // Skipped values [start, end) must still parse, so that loadJSON accepts the same texts.
+    auto checkSkipped = [&](ulong end)
+    {
+        if (!json::accept(text + start, text + end))
+            throw std::runtime_error("Error parsing DB: " + filename + ": invalid value at byte " + std::to_string(start));
+    };
+
+    for (ulong pos = 0; pos < size; pos++)
+    {
+        char c = text[pos];
+
+        if (inString)
+        {
+            if (c == '\\')
+            {
+                pos++;
+            }
+            else if (c == '"')
             {
-                uint meaningOffset = 0;
-                json& meaningPosRefs = termLangRef[FLD_MEANINGS];
-                json::const_iterator begin = meaningPosRefs.begin();
-                json::const_iterator end = meaningPosRefs.end();
+                inString = false;
 
-                for (auto posIt = begin; posIt != end; ++posIt)
+                if (depth == 1)
                 {
-                    string pos = string(posIt.key());
-                    json& meaningRefs = meaningPosRefs[pos];
-
-                    for (json& meaningRef : meaningRefs)
-                    {
-                        meaningRef[FLD_ID] = (ulong)(i * LANG_OFFSET_LIMIT * MEANING_OFFSET_LIMIT + langOffset * MEANING_OFFSET_LIMIT + meaningOffset);
-                        meaningOffset++;
-                    }
-
-                    if (!posIdx.count(pos))
-                    {
-                        posIdx[pos] = posCount;
-                        posTags.push_back(pos);
-                        posCount++;
-                    }
+                    checkSkipped(pos + 1);
+                    state = afterValue;
                 }
+            }
+        }
+        else if (depth >= 2)
+        {
+            // Inside a top-level value.
+            if (c == '"')
+                inString = true;
+            else if (c == '{' || c == '[')
+                depth++;
+            else if ((c == '}' || c == ']') && --depth == 1)
+            {
+                if (c != ((opener == '{') ? '}' : ']'))
+                    unexpected(pos);
 
-                langOffset++;
+                if (c == '}')
+                    ranges.push_back(std::make_pair(start, pos + 1));
+                else
+                    checkSkipped(pos + 1);
+
+                state = afterValue;
             }
+        }
+        else if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        {
+            continue;
+        }
+        else if (depth == 0)
+        {
+            if (state != beforeArray || c != '[')
+                unexpected(pos);
 
-            i++;
+            depth = 1;
+            state = firstValue;
+        }
+        else if (c == ',')
+        {
+            if (state != afterValue)
+                unexpected(pos);
+
+            state = nextValue;
+        }
+        else if (c == ']')
+        {
+            if (state != afterValue && state != firstValue)
+                unexpected(pos);
+
+            depth = 0;
+            state = afterArray;
+        }
+        else if (c == '}' || (state != firstValue && state != nextValue))
+        {
+            unexpected(pos);
+        }
+        else if (c == '{' || c == '[')
+        {
+            depth = 2;
+            start = pos;
+            opener = c;
+        }
+        else if (c == '"')
+        {
+            start = pos;
+            inString = true;
+        }
+        else
+        {
+            // Literal or number: up to the next separator.
+            for (start = pos; pos + 1 < size && !strchr(" \t\n\r,[]{}\"", text[pos + 1]);)
+                pos++;
+
+            checkSkipped(pos + 1);
+            state = afterValue;
         }
     }
 
-    isLoaded = true;
+    if (state != afterArray || inString)
+        throw std::runtime_error("Error parsing DB: " + filename + ": unexpected end of input");
+
+    return ranges;
+}
+
+// Entries are parsed on the pool threads, a batch at a time to bound the memory held by parsed entries.
+// They are then added sequentially in file order, so term indices, meaning IDs and POS tags match loadJSON.
+void WiktDB::loadJSONParallel(const string& filename, ThreadPool& pool)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat fileStat;
+
+    if (fd < 0)
+        throw std::runtime_error("Error opening DB: " + filename);
+
+    if (fstat(fd, &fileStat) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Error opening DB: " + filename);
+    }
+
+    ulong textSize = fileStat.st_size;
+    void *textMap = (textSize > 0) ? mmap(nullptr, textSize, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+
+    if (textMap == MAP_FAILED)
+        throw std::runtime_error("Error mapping DB: " + filename);
+
+    try
+    {
+        loadJSONText((const char*)textMap, textSize, filename, pool);
+    }
+    catch (...)
+    {
+        if (textMap)
+            munmap(textMap, textSize);
+        throw;
+    }
+
+    if (textMap)
+        munmap(textMap, textSize);
+
+    finishJSON();
 }
 
-umap<string, long>::size_type WiktDB::size()
+void WiktDB::loadJSONText(const char *text, ulong textSize, const string& filename, ThreadPool& pool)
+{
+    vector<std::pair<ulong, ulong>> ranges = entryRanges(text, textSize, filename);
+
+    db = new vector<json>();
+
+    for (ulong batchStart = 0; batchStart < ranges.size();)
+    {
+        ulong batchEnd = batchStart;
+
+        for (ulong batchBytes = 0; batchEnd < ranges.size() && batchBytes < WIKTDB_LOAD_BATCH_BYTES; batchEnd++)
+            batchBytes += ranges[batchEnd].second - ranges[batchEnd].first;
+
+        vector<json> entries(batchEnd - batchStart);
+        ulong numTasks = (entries.size() + WIKTDB_LOAD_TASK_ENTRIES - 1) / WIKTDB_LOAD_TASK_ENTRIES;
+        vector<std::exception_ptr> errors(numTasks);
+
+        pool.parallelFor(numTasks, [&](ulong task, uint)
+        {
+            ulong taskEnd = std::min((task + 1) * WIKTDB_LOAD_TASK_ENTRIES, (ulong)entries.size());
+
+            for (ulong i = task * WIKTDB_LOAD_TASK_ENTRIES; i < taskEnd; i++)
+            {
+                const std::pair<ulong, ulong>& range = ranges[batchStart + i];
+
+                try
+                {
+                    entries[i] = json::parse(text + range.first, text + range.second);
+                }
+                catch (json::parse_error& e)
+                {
+                    errors[task] = std::make_exception_ptr(std::runtime_error("Error parsing DB: " + filename + ": entry at byte " +
+                                                                              std::to_string(range.first) + ": " + e.what()));
+                    return;
+                }
+            }
+        });
+
+        for (std::exception_ptr& error : errors)
+        {
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        for (json& entry : entries)
+            addEntry(entry);
+
+        batchStart = batchEnd;
+    }
+}
+
+void WiktDB::finishJSON()
+{
+    db->shrink_to_fit();
+    blobData.shrink_to_fit();
+    blobs = isCached() ? blobData.data() : nullptr;
+    strings = stringData.data();
+    terms = termData.data();
+    langs = langData.data();
+    posRecs = posData.data();
+    meaningIds = meaningIdData.data();
+}
+
+void WiktDB::addEntry(json& entry)
+{
+    const string& title = entry[FLD_TITLE].get_ref<const string&>();
+
+    if (invIndex.count(title))
+        return;
+
+    ulong i = invIndex.insert(title);
+
+    TermRecord termRec = TermRecord();
+    termRec.title = addString(title);
+    termRec.firstLang = langData.size();
+
+    uint langOffset = 0;
+    json& termLangRefs = entry[FLD_LANGS];
+    for (auto langIt = termLangRefs.begin(); langIt != termLangRefs.end(); ++langIt)
+    {
+        json& termLangRef = langIt.value();
+        uint meaningOffset = 0;
+        json& meaningPosRefs = termLangRef[FLD_MEANINGS];
+        json::const_iterator begin = meaningPosRefs.begin();
+        json::const_iterator end = meaningPosRefs.end();
+
+        if (!langNames.count(langIt.key()))
+            langNames[langIt.key()] = addString(langIt.key());
+
+        LangRecord langRec = LangRecord();
+        langRec.name = langNames[langIt.key()];
+        langRec.firstPos = posData.size();
+
+        for (auto posIt = begin; posIt != end; ++posIt)
+        {
+            string pos = string(posIt.key());
+            json& meaningRefs = meaningPosRefs[pos];
+
+            if (!posIdx.count(pos))
+            {
+                posIdx[pos] = posTags.size();
+                posTags.push_back(pos);
+            }
+
+            PosRecord posRec = PosRecord();
+            posRec.firstMeaning = meaningIdData.size();
+            posRec.posTag = posIdx[pos];
+
+            for (json& meaningRef : meaningRefs)
+            {
+                meaningRef[FLD_ID] = (ulong)(i * LANG_OFFSET_LIMIT * MEANING_OFFSET_LIMIT + langOffset * MEANING_OFFSET_LIMIT + meaningOffset);
+                meaningIdData.push_back(meaningRef[FLD_ID]);
+                meaningOffset++;
+            }
+
+            posRec.numMeanings = meaningIdData.size() - posRec.firstMeaning;
+            posData.push_back(posRec);
+        }
+
+        langRec.numPos = posData.size() - langRec.firstPos;
+        langData.push_back(langRec);
+        langOffset++;
+    }
+
+    termRec.numLangs = langData.size() - termRec.firstLang;
+
+    // With a bounded cache, only the serialized entry (with meaning IDs assigned) is kept.
+    if (isCached())
+    {
+        vector<uint8_t> blob = json::to_cbor(entry);
+        termRec.blobOffset = blobData.size();
+        termRec.blobSize = blob.size();
+        blobData.insert(blobData.end(), blob.begin(), blob.end());
+    }
+    else
+    {
+        db->push_back(std::move(entry));
+    }
+
+    termData.push_back(termRec);
+}
+
+void WiktDB::loadImage(const string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat fileStat;
+
+    if (fd < 0)
+        throw std::runtime_error("Error opening DB image: " + filename);
+
+    if (fstat(fd, &fileStat) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("Error opening DB image: " + filename);
+    }
+
+    imageSize = fileStat.st_size;
+    image = mmap(nullptr, imageSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (image == MAP_FAILED)
+    {
+        image = nullptr;
+        throw std::runtime_error("Error mapping DB image: " + filename);
+    }
+
+    const char *base = (const char*)image;
+    const WiktDBImageHeader *header = (const WiktDBImageHeader*)base;
+
+    if (imageSize < sizeof(WiktDBImageHeader) || header->version != WIKTDB_IMAGE_VERSION || header->headerSize != sizeof(WiktDBImageHeader))
+        throw std::runtime_error("Incompatible DB image: " + filename + " (expected version " + std::to_string(WIKTDB_IMAGE_VERSION) + ")");
+
+    // Everything the records refer to is checked once here, so that accesses need no checks.
+    auto rangeFits = [](uint64_t first, uint64_t num, uint64_t size) { return first <= size && num <= size - first; };
+    auto sectionFits = [&](uint64_t offset, uint64_t num, uint64_t recordSize)
+    {
+        return offset % 8 == 0 && offset <= imageSize && num <= (imageSize - offset) / recordSize;
+    };
+    auto corrupt = [&](const string& what)
+    {
+        return std::runtime_error("Corrupt DB image: " + filename + ": " + what + " out of bounds");
+    };
+
+    if (!sectionFits(header->stringsOffset, header->stringsSize, 1) || !sectionFits(header->termsOffset, header->numTerms, sizeof(TermRecord)) ||
+        !sectionFits(header->langsOffset, header->numLangs, sizeof(LangRecord)) || !sectionFits(header->posOffset, header->numPos, sizeof(PosRecord)) ||
+        !sectionFits(header->meaningIdsOffset, header->numMeanings, sizeof(uint64_t)) ||
+        !sectionFits(header->posTagsOffset, header->numPosTags, sizeof(StringRecord)) || !sectionFits(header->blobsOffset, header->blobsSize, 1))
+    {
+        throw corrupt("section");
+    }
+
+    strings = base + header->stringsOffset;
+    terms = (const TermRecord*)(base + header->termsOffset);
+    langs = (const LangRecord*)(base + header->langsOffset);
+    posRecs = (const PosRecord*)(base + header->posOffset);
+    meaningIds = (const uint64_t*)(base + header->meaningIdsOffset);
+    blobs = (const ubyte*)(base + header->blobsOffset);
+
+    const StringRecord *posTagRecs = (const StringRecord*)(base + header->posTagsOffset);
+    auto stringFits = [&](const StringRecord& strRec) { return rangeFits(strRec.offset, strRec.length, header->stringsSize); };
+
+    for (ulong i = 0; i < header->numTerms; i++)
+    {
+        if (!stringFits(terms[i].title) || !rangeFits(terms[i].firstLang, terms[i].numLangs, header->numLangs) ||
+            !rangeFits(terms[i].blobOffset, terms[i].blobSize, header->blobsSize))
+        {
+            throw corrupt("term record " + std::to_string(i));
+        }
+    }
+
+    for (ulong i = 0; i < header->numLangs; i++)
+    {
+        if (!stringFits(langs[i].name) || !rangeFits(langs[i].firstPos, langs[i].numPos, header->numPos))
+            throw corrupt("language record " + std::to_string(i));
+    }
+
+    for (ulong i = 0; i < header->numPos; i++)
+    {
+        if (!rangeFits(posRecs[i].firstMeaning, posRecs[i].numMeanings, header->numMeanings) || posRecs[i].posTag >= header->numPosTags)
+            throw corrupt("POS record " + std::to_string(i));
+    }
+
+    for (ulong i = 0; i < header->numPosTags; i++)
+    {
+        if (!stringFits(posTagRecs[i]))
+            throw corrupt("POS tag " + std::to_string(i));
+
+        posTags.push_back(getString(posTagRecs[i]));
+        posIdx[posTags.back()] = i;
+    }
+
+    // Language names are stored once, so the first record of each name holds its ID.
+    for (ulong i = 0; i < header->numLangs; i++)
+        langNames.emplace(getString(langs[i].name), langs[i].name);
+
+    // Built in the same insertion order as loadJSON, so that terms get the same indices in both modes.
+    invIndex.reserve(header->numTerms, header->stringsSize);
+
+    for (ulong i = 0; i < header->numTerms; i++)
+    {
+        invIndex.insert(StringRef(strings + terms[i].title.offset, terms[i].title.length));
+    }
+
+    // Entries are decoded on first access, and kept if there is no bounded cache.
+    if (!isCached())
+    {
+        db = new vector<json>(header->numTerms);
+        decodeFlags.reset(new std::once_flag[header->numTerms]);
+    }
+}
+
+void WiktDB::writeImage(const string& filename)
+{
+    std::ofstream ofile(filename, std::ios::binary);
+    WiktDBImageHeader header = WiktDBImageHeader();
+    vector<TermRecord> termRecs(terms, terms + invIndex.size());
+    vector<StringRecord> posTagRecs;
+    const char padding[8] = {0};
+    ulong numLangs = 0, numPos = 0, numMeanings = 0;
+
+    if (!ofile)
+        throw std::runtime_error("Error opening DB image for writing: " + filename);
+
+    // The string table is only appended to, so POS tag names can be added to a copy of it.
+    // Those of an image are already in its table: their records are reused, so that recompiling gives the same image.
+    vector<char> imageStrings;
+
+    if (image)
+    {
+        const WiktDBImageHeader *srcHeader = (const WiktDBImageHeader*)image;
+        const StringRecord *srcPosTagRecs = (const StringRecord*)((const char*)image + srcHeader->posTagsOffset);
+        numLangs = srcHeader->numLangs;
+        numPos = srcHeader->numPos;
+        numMeanings = srcHeader->numMeanings;
+        imageStrings.assign(strings, strings + srcHeader->stringsSize);
+        posTagRecs.assign(srcPosTagRecs, srcPosTagRecs + srcHeader->numPosTags);
+    }
+    else
+    {
+        numLangs = langData.size();
+        numPos = posData.size();
+        numMeanings = meaningIdData.size();
+        imageStrings = stringData;
+    }
+
+    for (ulong i = posTagRecs.size(); i < posTags.size(); i++)
+    {
+        const string& posTag = posTags[i];
+        StringRecord strRec = StringRecord();
+        strRec.offset = imageStrings.size();
+        strRec.length = posTag.size();
+        imageStrings.insert(imageStrings.end(), posTag.begin(), posTag.end());
+        posTagRecs.push_back(strRec);
+    }
+
+    auto writeSection = [&](const void *data, ulong size) -> ulong
+    {
+        ulong offset = ofile.tellp();
+        ofile.write((const char*)data, size);
+        ofile.write(padding, (8 - size % 8) % 8);
+        return offset;
+    };
+
+    memcpy(header.magic, WIKTDB_IMAGE_MAGIC, WIKTDB_IMAGE_MAGIC_SIZE);
+    header.version = WIKTDB_IMAGE_VERSION;
+    header.headerSize = sizeof(WiktDBImageHeader);
+    header.numTerms = termRecs.size();
+    header.numLangs = numLangs;
+    header.numPos = numPos;
+    header.numMeanings = numMeanings;
+    header.numPosTags = posTags.size();
+    writeSection(&header, sizeof(header));
+
+    header.stringsSize = imageStrings.size();
+    header.stringsOffset = writeSection(imageStrings.data(), imageStrings.size());
+    header.langsOffset = writeSection(langs, numLangs * sizeof(LangRecord));
+    header.posOffset = writeSection(posRecs, numPos * sizeof(PosRecord));
+    header.meaningIdsOffset = writeSection(meaningIds, numMeanings * sizeof(uint64_t));
+    header.posTagsOffset = writeSection(posTagRecs.data(), posTagRecs.size() * sizeof(StringRecord));
+
+    // Entries (with meaning IDs already assigned) are serialized one at a time, to avoid holding all blobs in memory.
+    // Entries already kept serialized are copied as they are.
+    header.blobsOffset = ofile.tellp();
+    for (ulong i = 0; i < termRecs.size(); i++)
+    {
+        termRecs[i].blobOffset = (ulong)ofile.tellp() - header.blobsOffset;
+
+        if (blobs)
+        {
+            ofile.write((const char*)blobs + terms[i].blobOffset, terms[i].blobSize);
+        }
+        else
+        {
+            vector<uint8_t> blob = json::to_cbor((*db)[i]);
+            termRecs[i].blobSize = blob.size();
+            ofile.write((const char*)blob.data(), blob.size());
+        }
+    }
+    header.blobsSize = (ulong)ofile.tellp() - header.blobsOffset;
+    ofile.write(padding, (8 - header.blobsSize % 8) % 8);
+
+    header.termsOffset = writeSection(termRecs.data(), termRecs.size() * sizeof(TermRecord));
+
+    ofile.seekp(0);
+    ofile.write((const char*)&header, sizeof(header));
+    ofile.close();
+
+    if (!ofile)
+        throw std::runtime_error("Error writing DB image: " + filename);
+}
+
+StringRecord WiktDB::addString(const string& str)
+{
+    StringRecord strRec = StringRecord();
+    strRec.offset = stringData.size();
+    strRec.length = str.size();
+    stringData.insert(stringData.end(), str.begin(), str.end());
+
+    return strRec;
+}
+
+string WiktDB::getString(const StringRecord& strRec) const
+{
+    return string(strings + strRec.offset, strRec.length);
+}
+
+ulong WiktDB::size()
 {
     return invIndex.size();
 }
 
-ulong WiktDB::index(const string& term)
+ulong WiktDB::index(StringRef term)
 {
     return invIndex.at(term);
 }
 
-bool WiktDB::exists(const string& term)
+bool WiktDB::exists(StringRef term)
 {
     return invIndex.count(term) > 0;
 }
 
-ulong WiktDB::linkIndex(const string& term, ReprOffsetBase offsetBase)
+ulong WiktDB::linkIndex(StringRef term, ReprOffsetBase offsetBase)
 {
     return invIndex.size() * offsetBase + invIndex.at(term);
 }
 
-ulong WiktDB::etymLinkIndex(const string& term)
+ulong WiktDB::linkIndex(ulong index, ReprOffsetBase offsetBase)
+{
+    return invIndex.size() * offsetBase + index;
+}
+
+ulong WiktDB::etymLinkIndex(StringRef term)
 {
     return invIndex.size() * ReprOffsetBase::etymLink + invIndex.at(term);
 }
 
-ulong WiktDB::etymDecompIndex(const string& term, const string& type)
+ulong WiktDB::etymDecompIndex(StringRef term, const string& type)
 {
     if (type == FLD_ETYM_PREFIX)
         return invIndex.size() * ReprOffsetBase::prefix + invIndex.at(term);
@@ -106,14 +787,28 @@ ulong WiktDB::etymDecompIndex(const string& term, const string& type)
         return invIndex.size() * ReprOffsetBase::affix + invIndex.at(term);
     else if (type == FLD_ETYM_STEM)
         return invIndex.size() * ReprOffsetBase::stem + invIndex.at(term);
-    
+
     std::cerr << "Morphological decomposition type not recognized: " << type << std::endl;
     return invIndex.size() * ReprOffsetBase::stem + invIndex.at(term);
 }
 
 ulong WiktDB::posIndex(const string& pos)
 {
-    return invIndex.size() * ReprOffsetBase::pos + posIdx[pos];
+    auto posIt = posIdx.find(pos);
+
+    return invIndex.size() * ReprOffsetBase::pos + ((posIt != posIdx.end()) ? posIt->second : 0);
+}
+
+ulong WiktDB::posTagIndex(ulong posTag)
+{
+    return invIndex.size() * ReprOffsetBase::pos + posTag;
+}
+
+ulong WiktDB::posTag(const string& pos) const
+{
+    auto posIt = posIdx.find(pos);
+
+    return (posIt != posIdx.end()) ? posIt->second : npos;
 }
 
 const string& WiktDB::posName(ulong index)
@@ -126,12 +821,126 @@ ulong WiktDB::reprSize()
     return invIndex.size() * ReprOffsetBase::pos + posTags.size();
 }
 
-json& WiktDB::operator[] (const string& term)
+string WiktDB::title(ulong index) const
 {
-    return db->at(invIndex.at(term));
+    return getString(terms[index].title);
 }
 
-json& WiktDB::operator[] (vector<json>::size_type idx)
+const TermRecord& WiktDB::termRecord(ulong index) const
 {
-    return db->at(idx);
+    return terms[index];
+}
+
+const LangRecord* WiktDB::langRecord(ulong index, const string& lang) const
+{
+    const TermRecord& termRec = terms[index];
+
+    for (ulong i = termRec.firstLang; i < termRec.firstLang + termRec.numLangs; i++)
+    {
+        if (langs[i].name.length == lang.size() && lang.compare(0, lang.size(), strings + langs[i].name.offset, langs[i].name.length) == 0)
+            return &langs[i];
+    }
+
+    return nullptr;
+}
+
+ulong WiktDB::langId(const string& lang) const
+{
+    auto langIt = langNames.find(lang);
+
+    return (langIt != langNames.end()) ? langIt->second.offset : npos;
+}
+
+ulong WiktDB::langId(ulong index, uint i) const
+{
+    return langs[terms[index].firstLang + i].name.offset;
+}
+
+const PosRecord* WiktDB::posRecord(const LangRecord& langRec, const string& pos) const
+{
+    auto posIt = posIdx.find(pos);
+
+    if (posIt == posIdx.end())
+        return nullptr;
+
+    for (ulong i = langRec.firstPos; i < langRec.firstPos + langRec.numPos; i++)
+    {
+        if (posRecs[i].posTag == posIt->second)
+            return &posRecs[i];
+    }
+
+    return nullptr;
+}
+
+const PosRecord& WiktDB::posRecord(const LangRecord& langRec, uint i) const
+{
+    return posRecs[langRec.firstPos + i];
+}
+
+const uint64_t* WiktDB::meaningIdList(const PosRecord& posRec) const
+{
+    return meaningIds + posRec.firstMeaning;
+}
+
+EntryRef WiktDB::entry(StringRef term)
+{
+    return entry(invIndex.at(term));
+}
+
+EntryRef WiktDB::entry(ulong idx)
+{
+    if (idx >= invIndex.size())
+        throw std::out_of_range("WiktDB: entry index out of range: " + std::to_string(idx));
+
+    if (isCached())
+    {
+        EntryRef cached = cache.find(idx);
+
+        if (cached)
+            return cached;
+
+        // Decoded outside of the cache locks, so that misses on other entries are not serialized.
+        return cache.insert(idx, std::make_shared<const json>(json::from_cbor(blobs + terms[idx].blobOffset, terms[idx].blobSize)));
+    }
+
+    json& resident = (*db)[idx];
+
+    if (image)
+        std::call_once(decodeFlags[idx], [&] { resident = json::from_cbor(blobs + terms[idx].blobOffset, terms[idx].blobSize); });
+
+    // Resident entries live as long as the DB: the reference does not own them.
+    return EntryRef(EntryRef(), &resident);
+}
+
+TermEntryRef WiktDB::termEntry(ulong idx)
+{
+    if (idx >= invIndex.size())
+        throw std::out_of_range("WiktDB: entry index out of range: " + std::to_string(idx));
+
+    if (isCached() || !termEntryFlags)
+    {
+        TermEntryRef cached = termEntryCache.find(idx);
+
+        if (cached)
+            return cached;
+
+        // Built from a decoded entry that may be evicted right after: the typed entry does not refer to it.
+        EntryRef entryRef = entry(idx);
+
+        return termEntryCache.insert(idx, std::make_shared<const TermEntry>(*entryRef, idx, *this));
+    }
+
+    std::call_once(termEntryFlags[idx], [&] { termEntries[idx].reset(new TermEntry(*entry(idx), idx, *this)); });
+
+    return TermEntryRef(TermEntryRef(), termEntries[idx].get());
+}
+
+void WiktDB::releaseTermEntries()
+{
+    if (!termEntryFlags)
+        return;
+
+    vector<std::unique_ptr<const TermEntry>>().swap(termEntries);
+    termEntryFlags.reset();
+    termEntryCache.setCapacity(WIKTDB_TERM_ENTRY_CACHE_SIZE);
 }
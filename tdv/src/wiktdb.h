@@ -5,14 +5,36 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <list>
 #include <json/json.hpp>
 #include "types.h"
+#include "stringutils.h"
+#include "termindex.h"
+#include "threadpool.h"
+#include "wiktentry.h"
 
 using nlohmann::json;
 
 #define LANG_OFFSET_LIMIT 1000
 #define MEANING_OFFSET_LIMIT 10000
 
+//Compiled DB image
+#define WIKTDB_IMAGE_MAGIC "TDVWKTDB"
+#define WIKTDB_IMAGE_MAGIC_SIZE 8
+#define WIKTDB_IMAGE_VERSION 1
+
+//Decoded entry cache
+#define WIKTDB_CACHE_SHARDS 16
+// Typed entries kept once the resident ones are released.
+#define WIKTDB_TERM_ENTRY_CACHE_SIZE 4096
+
+//Parallel JSON loading: entries parsed per task, and JSON bytes parsed before each sequential indexing pass
+#define WIKTDB_LOAD_TASK_ENTRIES 256
+#define WIKTDB_LOAD_BATCH_BYTES (64ul << 20)
+
 //WiktDB related fields
 #define FLD_LANGS "langs"
 #define FLD_MEANINGS "meanings"
@@ -62,32 +84,222 @@ enum ReprOffsetBase
     pos = 14
 };
 
+// Compiled DB image layout (native byte order, 8-byte aligned sections):
+// header | string table | language records | POS records | meaning IDs | POS tags | entry blobs (CBOR) | term records
+// All offsets are relative to the start of the image, except string and blob offsets,
+// which are relative to the start of their sections.
+struct StringRecord
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct TermRecord
+{
+    StringRecord title;
+    uint64_t firstLang;
+    uint32_t numLangs;
+    uint32_t reserved;
+    uint64_t blobOffset;
+    uint64_t blobSize;
+};
+
+struct LangRecord
+{
+    StringRecord name;
+    uint64_t firstPos;
+    uint32_t numPos;
+    uint32_t reserved;
+};
+
+struct PosRecord
+{
+    uint64_t firstMeaning;
+    uint32_t posTag;
+    uint32_t numMeanings;
+};
+
+struct WiktDBImageHeader
+{
+    char magic[WIKTDB_IMAGE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t numTerms;
+    uint64_t numLangs;
+    uint64_t numPos;
+    uint64_t numMeanings;
+    uint64_t numPosTags;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t langsOffset;
+    uint64_t posOffset;
+    uint64_t meaningIdsOffset;
+    uint64_t posTagsOffset;
+    uint64_t blobsOffset;
+    uint64_t blobsSize;
+    uint64_t termsOffset;
+};
+
+// Decoded DB entry. Entries held in an EntryCache stay valid while referenced, even if evicted meanwhile.
+typedef std::shared_ptr<const json> EntryRef;
+
+// Bounded LRU of decoded values by term index, split in independently locked shards so that concurrent requests
+// rarely contend.
+template <class Value>
+class LruCache
+{
+    typedef std::shared_ptr<const Value> ValueRef;
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<std::pair<ulong, ValueRef>> lru;
+        umap<ulong, typename std::list<std::pair<ulong, ValueRef>>::iterator> index;
+    };
+
+    Shard shards[WIKTDB_CACHE_SHARDS];
+    ulong shardCapacity = 0;
+
+    public:
+    void setCapacity(ulong capacity) { shardCapacity = (capacity + WIKTDB_CACHE_SHARDS - 1) / WIKTDB_CACHE_SHARDS; }
+    ulong capacity() const { return shardCapacity * WIKTDB_CACHE_SHARDS; }
+    // Cached value, or an empty reference if not cached.
+    ValueRef find(ulong idx);
+    // Caches the value, evicting the least recently used ones. Returns the cached value if another thread added it first.
+    ValueRef insert(ulong idx, ValueRef value);
+};
+
+template <class Value>
+std::shared_ptr<const Value> LruCache<Value>::find(ulong idx)
+{
+    Shard& shard = shards[idx % WIKTDB_CACHE_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(idx);
+
+    if (it == shard.index.end())
+        return ValueRef();
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+
+    return it->second->second;
+}
+
+template <class Value>
+std::shared_ptr<const Value> LruCache<Value>::insert(ulong idx, ValueRef value)
+{
+    Shard& shard = shards[idx % WIKTDB_CACHE_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(idx);
+
+    if (it != shard.index.end())
+    {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->second;
+    }
+
+    shard.lru.emplace_front(idx, value);
+    shard.index[idx] = shard.lru.begin();
+
+    while (shard.lru.size() > shardCapacity)
+    {
+        shard.index.erase(shard.lru.back().first);
+        shard.lru.pop_back();
+    }
+
+    return value;
+}
+
+typedef LruCache<json> EntryCache;
+
 class WiktDB
 {
     private:
-    vector<json> *db;
+    vector<json> *db = nullptr;
     umap<string, ulong> posIdx;
     vector<string> posTags;
-    bool isLoaded;
+    // String records of the language names, by name.
+    umap<string, StringRecord> langNames;
+    bool isLoaded = false;
+
+    // Term, language, POS and meaning records. Owned when loaded from JSON, mapped when loaded from an image.
+    vector<char> stringData;
+    vector<TermRecord> termData;
+    vector<LangRecord> langData;
+    vector<PosRecord> posData;
+    vector<uint64_t> meaningIdData;
+    const char *strings = nullptr;
+    const TermRecord *terms = nullptr;
+    const LangRecord *langs = nullptr;
+    const PosRecord *posRecs = nullptr;
+    const uint64_t *meaningIds = nullptr;
+    const ubyte *blobs = nullptr;
+    void *image = nullptr;
+    size_t imageSize = 0;
+    std::unique_ptr<std::once_flag[]> decodeFlags;
+    // Entries serialized as CBOR, when loaded from JSON with a bounded cache.
+    vector<ubyte> blobData;
+    EntryCache cache;
+    // Typed entries, built on first access: resident unless there is a bounded cache, or until they are released.
+    vector<std::unique_ptr<const TermEntry>> termEntries;
+    std::unique_ptr<std::once_flag[]> termEntryFlags;
+    LruCache<TermEntry> termEntryCache;
+
+    void loadJSON(const string& filename);
+    void loadJSONParallel(const string& filename, ThreadPool& pool);
+    void loadJSONText(const char *text, ulong textSize, const string& filename, ThreadPool& pool);
+    // Points the record views at the records built by the JSON loaders.
+    void finishJSON();
+    void addEntry(json& entry);
+    bool isCached() const { return cache.capacity() > 0; }
+    void loadImage(const string& filename);
+    StringRecord addString(const string& str);
+    string getString(const StringRecord& strRec) const;
 
     public:
-    umap<string, ulong> invIndex;
+    static const ulong npos = ~0ul;
+    TermIndex invIndex;
 
     WiktDB()=default;
     ~WiktDB();
 
-    void loadDB(const string& filename);
-    umap<string, long>::size_type size();
-    ulong index(const string& term);
-    bool exists(const string& term);
-    ulong linkIndex(const string& term, ReprOffsetBase offsetBase);
-    ulong etymLinkIndex(const string& term);
-    ulong etymDecompIndex(const string& term, const string& type);
+    // With cacheSize > 0, entries are kept serialized and decoded on access into an LRU of at most cacheSize entries.
+    // Otherwise all decoded entries stay resident.
+    // JSON files are parsed on the pool threads, if a pool with more than one thread is given.
+    void loadDB(const string& filename, ulong cacheSize = 0, ThreadPool *pool = nullptr);
+    void writeImage(const string& filename);
+    static bool isImage(const string& filename);
+    // Peak resident set size of the process, in bytes.
+    static ulong peakRSS();
+    ulong size();
+    ulong index(StringRef term);
+    bool exists(StringRef term);
+    ulong linkIndex(StringRef term, ReprOffsetBase offsetBase);
+    ulong linkIndex(ulong index, ReprOffsetBase offsetBase);
+    ulong etymLinkIndex(StringRef term);
+    ulong etymDecompIndex(StringRef term, const string& type);
     ulong posIndex(const string& pos);
+    ulong posTagIndex(ulong posTag);
+    // POS tag of the POS name, or npos if no entry has it.
+    ulong posTag(const string& pos) const;
     const string& posName(ulong index);
     ulong reprSize();
-    json& operator[] (const string& term);
-    json& operator[] (vector<json>::size_type idx);
+    string title(ulong index) const;
+    const TermRecord& termRecord(ulong index) const;
+    const LangRecord* langRecord(ulong index, const string& lang) const;
+    // ID of the language name (the string table offset of the name, stored once), or npos if no entry has it.
+    ulong langId(const string& lang) const;
+    // ID of the i-th language of the term.
+    ulong langId(ulong index, uint i) const;
+    const PosRecord* posRecord(const LangRecord& langRec, const string& pos) const;
+    const PosRecord& posRecord(const LangRecord& langRec, uint i) const;
+    const uint64_t* meaningIdList(const PosRecord& posRec) const;
+    EntryRef entry(StringRef term);
+    EntryRef entry(ulong idx);
+    TermEntryRef termEntry(ulong idx);
+    // Frees the resident typed entries, once they are no longer read in bulk: later ones are built again,
+    // and at most WIKTDB_TERM_ENTRY_CACHE_SIZE of them kept. Must not run concurrently with termEntry.
+    void releaseTermEntries();
 };
 
 #endif
@@ -0,0 +1,41 @@
+#include <iostream>
+#include "types.h"
+#include "config.h"
+#include "wiktdb.h"
+
+void compileDB(const string& configFileName, const string& oFileName)
+{
+    Config config;
+    config.load(configFileName);
+
+    WiktDB wiktdb;
+    ThreadPool pool(config.numThreads);
+    std::cout << "Loading DB..." << std::endl;
+    wiktdb.loadDB(config.wiktDBPath, config.wiktDBCacheSize, &pool);
+    std::cout << "DB loaded." << std::endl;
+
+    std::cout << "Writing DB image..." << std::endl;
+    wiktdb.writeImage(oFileName);
+    std::cout << "DB image written: " << wiktdb.size() << " terms." << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4 || string(argv[1]) != "compile")
+    {
+        std::cout << "Usage: " << argv[0] << " compile <config. filename> <output filename>" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        compileDB(argv[2], argv[3]);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
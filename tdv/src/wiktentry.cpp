@@ -0,0 +1,434 @@
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include "wiktentry.h"
+#include "wiktdb.h"
+#include "stringutils.h"
+
+using nlohmann::json;
+
+static const json NULL_JSON;
+static const string EMPTY_STRING;
+
+// Fields missing or of another type read as null or empty, since the entry is shared and cannot be added to.
+static const json& field(const json& object, const char *name)
+{
+    auto it = object.find(name);
+
+    return (it != object.end()) ? *it : NULL_JSON;
+}
+
+static const json& element(const json& array, size_t i)
+{
+    return (array.is_array() && i < array.size()) ? array[i] : NULL_JSON;
+}
+
+static const string& stringValue(const json& value)
+{
+    return value.is_string() ? value.get_ref<const string&>() : EMPTY_STRING;
+}
+
+// Appends the index of the term, if in the DB.
+static void addTerm(vector<uint32_t>& ids, const TermIndex& terms, StringRef term)
+{
+    ulong idx = terms.find(term);
+
+    if (idx != TermIndex::npos)
+        ids.push_back(idx);
+}
+
+static void addTerm(vector<uint32_t>& ids, const TermIndex& terms, const json& term)
+{
+    if (term.is_string())
+        addTerm(ids, terms, StringRef(term.get_ref<const string&>()));
+}
+
+// Matches "^not? .*": a description starting with "no " or "not ", on a single line.
+static bool isNegation(const string& descr)
+{
+    size_t prefixSize;
+
+    if (descr.compare(0, 3, "no ") == 0)
+        prefixSize = 3;
+    else if (descr.compare(0, 4, "not ") == 0)
+        prefixSize = 4;
+    else
+        return false;
+
+    return descr.find_first_of("\r\n", prefixSize) == string::npos;
+}
+
+// Matches "^(a|an)? " + link, with the link taken literally.
+static bool isArticleLink(const string& descr, const string& link)
+{
+    size_t linkPos = descr.size() - std::min(descr.size(), link.size());
+
+    if (descr.compare(linkPos, string::npos, link) != 0)
+        return false;
+
+    return descr.compare(0, linkPos, " ") == 0 || descr.compare(0, linkPos, "a ") == 0 || descr.compare(0, linkPos, "an ") == 0;
+}
+
+TermEntry::TermEntry(const json& entry, ulong index, WiktDB& wiktdb) : index(index), redirect(TERM_ENTRY_NONE), headNoun(TERM_ENTRY_NONE)
+{
+    const TermIndex& terms = wiktdb.invIndex;
+    umap<string, uint32_t> words;
+    // By offset base, from ReprOffsetBase::etymLink on.
+    vector<uint32_t> etymIds[6];
+
+    const json& redirectRef = element(field(entry, FLD_REDIRECT), 0);
+
+    if (redirectRef.is_string() && terms.count(redirectRef.get_ref<const string&>()))
+        redirect = terms.find(redirectRef.get_ref<const string&>());
+
+    contextSynonyms.begin = ids.size();
+
+    for (const json& synRef : field(entry, FLD_SYNONYMS))
+        addTerm(ids, terms, field(synRef, FLD_MEANING_DESCR));
+
+    for (const json& abbrRef : field(entry, FLD_ABBREV))
+        addTerm(ids, terms, abbrRef);
+
+    contextSynonyms.end = ids.size();
+
+    const json& langRefs = field(entry, FLD_LANGS);
+
+    if (langRefs.is_object())
+    {
+        // Meaning IDs follow WiktDB::addEntry: by language and meaning offset, meanings counted across POS.
+        uint langOffset = 0;
+
+        for (auto langIt = langRefs.begin(); langIt != langRefs.end(); ++langIt, langOffset++)
+        {
+            const json& langRef = langIt.value();
+            const json& meaningPosRefs = field(langRef, FLD_MEANINGS);
+            LangEntry langEntry = LangEntry();
+            langEntry.lang = wiktdb.langId(index, langOffset);
+            langEntry.firstPos = posLists.size();
+            langEntry.firstMeaning = meanings.size();
+
+            for (auto posIt = meaningPosRefs.begin(); posIt != meaningPosRefs.end(); ++posIt)
+            {
+                PosEntry posEntry = PosEntry();
+                posEntry.posTag = wiktdb.posTag(posIt.key());
+                posEntry.firstMeaning = meanings.size();
+
+                for (const json& meaningRef : posIt.value())
+                {
+                    uint64_t id = index * LANG_OFFSET_LIMIT * MEANING_OFFSET_LIMIT + langOffset * MEANING_OFFSET_LIMIT + (meanings.size() - langEntry.firstMeaning);
+                    addMeaning(meaningRef, id, posEntry.posTag, wiktdb, words);
+                }
+
+                posEntry.numMeanings = meanings.size() - posEntry.firstMeaning;
+                posLists.push_back(posEntry);
+            }
+
+            langEntry.numPos = posLists.size() - langEntry.firstPos;
+            langEntry.firstSynonymList = synonymLists.size();
+            addSynonyms(langRef, wiktdb);
+            langEntry.numSynonymLists = synonymLists.size() - langEntry.firstSynonymList;
+            langEntry.firstTranslationList = translationLists.size();
+            addTranslations(langRef, wiktdb, words);
+            langEntry.numTranslationLists = translationLists.size() - langEntry.firstTranslationList;
+
+            const json& etymRef = field(langRef, FLD_ETYMOLOGY);
+
+            for (const json& linkRef : field(etymRef, FLD_LINKS))
+                addTerm(etymIds[ReprOffsetBase::etymLink - ReprOffsetBase::etymLink], terms, linkRef);
+
+            addTerm(etymIds[ReprOffsetBase::prefix - ReprOffsetBase::etymLink], terms, field(etymRef, FLD_ETYM_PREFIX));
+            addTerm(etymIds[ReprOffsetBase::suffix - ReprOffsetBase::etymLink], terms, field(etymRef, FLD_ETYM_SUFFIX));
+            addTerm(etymIds[ReprOffsetBase::stem - ReprOffsetBase::etymLink], terms, field(etymRef, FLD_ETYM_STEM));
+
+            for (const json& morphemeRef : field(etymRef, FLD_ETYM_CONFIX))
+                addTerm(etymIds[ReprOffsetBase::confix - ReprOffsetBase::etymLink], terms, morphemeRef);
+
+            for (const json& morphemeRef : field(etymRef, FLD_ETYM_AFFIX))
+                addTerm(etymIds[ReprOffsetBase::affix - ReprOffsetBase::etymLink], terms, morphemeRef);
+
+            langs.push_back(langEntry);
+        }
+
+        if (!langs.empty() && stringValue(element(field(langRefs.begin().value(), FLD_POS_ORDER), 0)) == "noun")
+        {
+            const PosEntry *nounPos = posList(langs[0], wiktdb.posTag("noun"));
+
+            if (nounPos && nounPos->numMeanings)
+                headNoun = nounPos->firstMeaning;
+        }
+    }
+
+    for (uint i = 0; i < 6; i++)
+    {
+        etymology[i] = IdRange(ids.size(), ids.size() + etymIds[i].size());
+        ids.insert(ids.end(), etymIds[i].begin(), etymIds[i].end());
+    }
+
+    ids.shrink_to_fit();
+}
+
+void TermEntry::addMeaning(const json& meaningRef, uint64_t id, uint32_t posTag, WiktDB& wiktdb, umap<string, uint32_t>& words)
+{
+    const TermIndex& terms = wiktdb.invIndex;
+    const string& descr = stringValue(field(meaningRef, FLD_MEANING_DESCR));
+    const json& linkRefs = field(meaningRef, FLD_LINKS);
+    const json& attrRefs = field(meaningRef, FLD_ATTRS);
+    MeaningEntry meaning = MeaningEntry();
+    StringRef word;
+    uint numWords = 0;
+
+    meaning.id = id;
+    meaning.posTag = posTag;
+
+    meaning.weakLinks.begin = ids.size();
+
+    for (Tokenizer tokenizer(descr, " "); tokenizer.next(word); numWords++)
+    {
+        ulong wordIdx = terms.find(word);
+
+        if (wordIdx == TermIndex::npos)
+            wordIdx = terms.find(StringUtils::toLower(word.str()));
+
+        if (wordIdx != TermIndex::npos)
+            ids.push_back(wordIdx);
+    }
+
+    meaning.weakLinks.end = ids.size();
+    meaning.singleWord = (numWords == 1);
+
+    meaning.hasLinks = meaningRef.count(FLD_LINKS) > 0;
+    meaning.numLinks = linkRefs.size();
+    meaning.links.begin = ids.size();
+
+    for (const json& linkRef : linkRefs)
+        addTerm(ids, terms, linkRef);
+
+    meaning.links.end = ids.size();
+
+    if (meaning.numLinks == 1)
+    {
+        const string& link = stringValue(*linkRefs.begin());
+
+        if (terms.count(link))
+        {
+            if (isNegation(descr))
+                meaning.linkSynSign = -1;
+            else if (isArticleLink(descr, link))
+                meaning.linkSynSign = 1;
+        }
+    }
+
+    meaning.context.begin = ids.size();
+
+    for (const json& attrRef : attrRefs)
+    {
+        const string& attrName = stringValue(element(attrRef, 0));
+
+        if (attrName == "context" || attrName == "label" || attrName == "lb")
+        {
+            for (Tokenizer tokenizer(stringValue(element(attrRef, 1)), "|"); tokenizer.next(word);)
+                addTerm(ids, terms, word);
+        }
+    }
+
+    meaning.context.end = ids.size();
+    meaning.inflecStems.begin = ids.size();
+
+    for (const json& attrRef : attrRefs)
+    {
+        if (stringValue(element(attrRef, 0)) == "inflec")
+            addTerm(ids, terms, element(attrRef, 2));
+    }
+
+    meaning.inflecStems.end = ids.size();
+    meaning.hypernymWords.begin = ids.size();
+
+    string clnDescr = StringUtils::stripTemplates(descr);
+
+    for (Tokenizer tokenizer(clnDescr, " "); tokenizer.next(word);)
+        addTerm(ids, terms, word);
+
+    meaning.hypernymWords.end = ids.size();
+    meaning.descrWords = addWords(descr, words);
+
+    meanings.push_back(meaning);
+}
+
+void TermEntry::addSynonyms(const json& langRef, WiktDB& wiktdb)
+{
+    const TermIndex& terms = wiktdb.invIndex;
+    vector<uint32_t> synIds;
+    StringRef token;
+
+    for (bool antonyms : {false, true})
+    {
+        const json& synPosRefs = field(langRef, antonyms ? FLD_ANTONYMS : FLD_SYNONYMS);
+
+        if (!synPosRefs.is_object())
+            continue;
+
+        for (auto posIt = synPosRefs.begin(); posIt != synPosRefs.end(); ++posIt)
+        {
+            ulong posTag = wiktdb.posTag(posIt.key());
+
+            // No meaning has the POS.
+            if (posTag == WiktDB::npos)
+                continue;
+
+            SynonymListEntry synList = SynonymListEntry();
+            synList.posTag = posTag;
+            synList.antonyms = antonyms;
+            synList.first = synonyms.size();
+
+            for (const json& synRef : posIt.value())
+            {
+                if (synRef.count(FLD_ATTRS))
+                {
+                    for (const json& attrRef : synRef[FLD_ATTRS])
+                    {
+                        const string& attrName = stringValue(element(attrRef, 0));
+                        synIds.clear();
+
+                        if (attrName == "sense")
+                        {
+                            for (Tokenizer tokenizer(stringValue(element(attrRef, 1)), ","); tokenizer.next(token);)
+                                addTerm(synIds, terms, token);
+                        }
+                        else if (attrName == "l" || attrName == "label")
+                        {
+                            addTerm(synIds, terms, element(attrRef, 1));
+                        }
+
+                        for (uint32_t synIdx : synIds)
+                            synonyms.push_back(SynonymEntry{synIdx, attrName == "sense"});
+                    }
+                }
+                else
+                {
+                    synIds.clear();
+                    addTerm(synIds, terms, field(synRef, FLD_MEANING_DESCR));
+
+                    for (uint32_t synIdx : synIds)
+                        synonyms.push_back(SynonymEntry{synIdx, false});
+                }
+            }
+
+            synList.num = synonyms.size() - synList.first;
+            synonymLists.push_back(synList);
+        }
+    }
+}
+
+void TermEntry::addTranslations(const json& langRef, WiktDB& wiktdb, umap<string, uint32_t>& words)
+{
+    const json& translPosRefs = field(langRef, FLD_TRANSLATIONS);
+
+    if (!translPosRefs.is_object())
+        return;
+
+    for (auto posIt = translPosRefs.begin(); posIt != translPosRefs.end(); ++posIt)
+    {
+        ulong posTag = wiktdb.posTag(posIt.key());
+
+        if (posTag == WiktDB::npos)
+            continue;
+
+        TranslationListEntry translList = TranslationListEntry();
+        translList.posTag = posTag;
+        translList.first = translations.size();
+
+        for (const json& translMeaningRef : posIt.value())
+        {
+            TranslationEntry transl = TranslationEntry();
+            transl.descrWords = addWords(stringValue(field(translMeaningRef, FLD_MEANING_DESCR)), words);
+            transl.terms.begin = ids.size();
+
+            for (const json& translTermRefs : field(translMeaningRef, FLD_TRANSL))
+            {
+                for (const json& translTermRef : translTermRefs)
+                    addTerm(ids, wiktdb.invIndex, element(translTermRef, 0));
+            }
+
+            transl.terms.end = ids.size();
+            translations.push_back(transl);
+        }
+
+        translList.num = translations.size() - translList.first;
+        translationLists.push_back(translList);
+    }
+}
+
+IdRange TermEntry::addWords(const string& descr, umap<string, uint32_t>& words)
+{
+    IdRange range(ids.size(), ids.size());
+
+    for (const string& word : StringUtils::split(StringUtils::toLower(descr)))
+    {
+        auto wordIt = words.emplace(word, words.size()).first;
+        ids.push_back(wordIt->second);
+    }
+
+    std::sort(ids.begin() + range.begin, ids.end());
+    range.end = std::unique(ids.begin() + range.begin, ids.end()) - ids.begin();
+    ids.resize(range.end);
+
+    return range;
+}
+
+const LangEntry* TermEntry::lang(uint64_t langId) const
+{
+    for (const LangEntry& langEntry : langs)
+    {
+        if (langEntry.lang == langId)
+            return &langEntry;
+    }
+
+    return nullptr;
+}
+
+const PosEntry* TermEntry::posList(const LangEntry& langEntry, uint32_t posTag) const
+{
+    for (uint32_t i = langEntry.firstPos; i < langEntry.firstPos + langEntry.numPos; i++)
+    {
+        if (posLists[i].posTag == posTag)
+            return &posLists[i];
+    }
+
+    return nullptr;
+}
+
+const SynonymListEntry* TermEntry::synonymList(const LangEntry& langEntry, uint32_t posTag, bool antonyms) const
+{
+    for (uint32_t i = langEntry.firstSynonymList; i < langEntry.firstSynonymList + langEntry.numSynonymLists; i++)
+    {
+        if (synonymLists[i].posTag == posTag && synonymLists[i].antonyms == antonyms)
+            return &synonymLists[i];
+    }
+
+    return nullptr;
+}
+
+const TranslationListEntry* TermEntry::translationList(const LangEntry& langEntry, uint32_t posTag) const
+{
+    for (uint32_t i = langEntry.firstTranslationList; i < langEntry.firstTranslationList + langEntry.numTranslationLists; i++)
+    {
+        if (translationLists[i].posTag == posTag)
+            return &translationLists[i];
+    }
+
+    return nullptr;
+}
+
+const MeaningEntry& TermEntry::meaning(ulong meaningId) const
+{
+    ulong langOffset = (meaningId / MEANING_OFFSET_LIMIT) % LANG_OFFSET_LIMIT;
+    ulong meaningOffset = meaningId % MEANING_OFFSET_LIMIT;
+
+    if (meaningId / (LANG_OFFSET_LIMIT * MEANING_OFFSET_LIMIT) != index || langOffset >= langs.size() ||
+        langs[langOffset].firstMeaning + meaningOffset >= (langOffset + 1 < langs.size() ? langs[langOffset + 1].firstMeaning : meanings.size()))
+    {
+        throw std::out_of_range("TermEntry: meaning ID not in entry: " + std::to_string(meaningId));
+    }
+
+    return meanings[langs[langOffset].firstMeaning + meaningOffset];
+}
@@ -0,0 +1,161 @@
+#ifndef WIKTENTRY_H
+#define WIKTENTRY_H
+#include <cstdint>
+#include <memory>
+#include <json/json.hpp>
+#include "types.h"
+
+using nlohmann::json;
+
+class WiktDB;
+
+// No term / meaning.
+#define TERM_ENTRY_NONE 0xffffffffu
+
+// Range [begin, end) of TermEntry::ids.
+struct IdRange
+{
+    uint32_t begin;
+    uint32_t end;
+
+    IdRange() : begin(0), end(0) {}
+    IdRange(uint32_t begin, uint32_t end) : begin(begin), end(end) {}
+
+    uint32_t size() const { return end - begin; }
+};
+
+// IDs of a range, for range-based for loops.
+struct IdSpan
+{
+    const uint32_t *first;
+    const uint32_t *last;
+
+    const uint32_t* begin() const { return first; }
+    const uint32_t* end() const { return last; }
+    size_t size() const { return last - first; }
+};
+
+// Term indices are those of WiktDB::invIndex. Only the terms found in the DB are kept, as no vector dimension
+// refers to the others.
+struct MeaningEntry
+{
+    uint64_t id;
+    uint32_t posTag;
+    // Description words, or their lowercase forms.
+    IdRange weakLinks;
+    IdRange links;
+    IdRange inflecStems;
+    // Context labels (context, label and lb attributes).
+    IdRange context;
+    // Description words with templates stripped: candidate hypernym heads.
+    IdRange hypernymWords;
+    // Entry-local IDs of the distinct lowercase description words, sorted. Only comparable within the same entry.
+    IdRange descrWords;
+    // All links, including those not in the DB.
+    uint32_t numLinks;
+    bool hasLinks;
+    bool singleWord;
+    // Sign of the synonym link to the only link: 1 for "(a|an) <link>", -1 for a negation, 0 if none.
+    int8_t linkSynSign;
+};
+
+// Meanings of one POS, in TermEntry::meanings.
+struct PosEntry
+{
+    uint32_t posTag;
+    uint32_t firstMeaning;
+    uint32_t numMeanings;
+};
+
+struct SynonymEntry
+{
+    uint32_t term;
+    // From a sense attribute: only linked if the sense matches the meaning context.
+    bool senseCheck;
+};
+
+// Synonyms (or antonyms) of one POS, in TermEntry::synonyms.
+struct SynonymListEntry
+{
+    uint32_t posTag;
+    bool antonyms;
+    uint32_t first;
+    uint32_t num;
+};
+
+struct TranslationEntry
+{
+    // Same ID space as MeaningEntry::descrWords.
+    IdRange descrWords;
+    IdRange terms;
+};
+
+// Translation senses of one POS, in TermEntry::translations.
+struct TranslationListEntry
+{
+    uint32_t posTag;
+    uint32_t first;
+    uint32_t num;
+};
+
+// Language sections are in entry order, so that the language offset of a meaning ID indexes them.
+// POS lists are in entry order, and so are the meanings they cover.
+struct LangEntry
+{
+    // String table offset of the language name, as in the language records of WiktDB.
+    uint64_t lang;
+    uint32_t firstPos;
+    uint32_t numPos;
+    uint32_t firstMeaning;
+    uint32_t firstSynonymList;
+    uint32_t numSynonymLists;
+    uint32_t firstTranslationList;
+    uint32_t numTranslationLists;
+};
+
+// Typed form of a Wiktionary entry (wikt_entry_schema.json), holding what vector generation reads from it.
+// Strings are resolved to term indices, POS tags and language IDs when the entry is built, and all ID lists
+// share one array.
+class TermEntry
+{
+    public:
+    uint32_t index;
+    // Redirection target, if in the DB.
+    uint32_t redirect;
+    // First noun meaning of the first language, if its first POS is noun: where hypernym chains continue.
+    uint32_t headNoun;
+    // Etymology links and morphemes, by offset base from ReprOffsetBase::etymLink to ReprOffsetBase::stem.
+    IdRange etymology[6];
+    // Top-level synonyms and abbreviations.
+    IdRange contextSynonyms;
+
+    vector<LangEntry> langs;
+    vector<PosEntry> posLists;
+    vector<MeaningEntry> meanings;
+    vector<SynonymListEntry> synonymLists;
+    vector<SynonymEntry> synonyms;
+    vector<TranslationListEntry> translationLists;
+    vector<TranslationEntry> translations;
+    vector<uint32_t> ids;
+
+    private:
+    void addMeaning(const json& meaningRef, uint64_t id, uint32_t posTag, WiktDB& wiktdb, umap<string, uint32_t>& words);
+    void addSynonyms(const json& langRef, WiktDB& wiktdb);
+    void addTranslations(const json& langRef, WiktDB& wiktdb, umap<string, uint32_t>& words);
+    // Distinct lowercase words of the description, as entry-local IDs.
+    IdRange addWords(const string& descr, umap<string, uint32_t>& words);
+
+    public:
+    TermEntry(const json& entry, ulong index, WiktDB& wiktdb);
+
+    IdSpan span(IdRange range) const { return IdSpan{ids.data() + range.begin, ids.data() + range.end}; }
+    const LangEntry* lang(uint64_t langId) const;
+    const PosEntry* posList(const LangEntry& langEntry, uint32_t posTag) const;
+    const SynonymListEntry* synonymList(const LangEntry& langEntry, uint32_t posTag, bool antonyms) const;
+    const TranslationListEntry* translationList(const LangEntry& langEntry, uint32_t posTag) const;
+    const MeaningEntry& meaning(ulong meaningId) const;
+};
+
+typedef std::shared_ptr<const TermEntry> TermEntryRef;
+
+#endif